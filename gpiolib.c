@@ -144,64 +144,115 @@ int gpio_export(int gpio)
 	return 0;
 }
 
+// Exports the pin unless its gpioN directory already exists.  Returns 1 if
+// we exported it (and so should unexport it afterwards), 0 if it was
+// already exported by someone else, negative on failure.
+int gpio_claim(int gpio)
+{
+	char buf[50];
+	struct stat st;
+	int ret;
+
+	sprintf(buf, "/sys/class/gpio/gpio%d", gpio);
+	if(stat(buf, &st) == 0 && S_ISDIR(st.st_mode))
+		return 0;
+	ret = gpio_export(gpio);
+	return ret ? ret : 1;
+}
+
 void gpio_unexport(int gpio)
 {
 	int gpiofd;
 	char buf[50];
+	gpio_close(gpio);
 	gpiofd = open("/sys/class/gpio/unexport", O_WRONLY);
 	sprintf(buf, "%d", gpio);
 	write(gpiofd, buf, strlen(buf));
 	close(gpiofd);
 }
 
-int gpio_read(int gpio)
+#ifndef GPIO_MAX_PINS
+#define GPIO_MAX_PINS 256
+#endif
+
+// Value file fds kept open between calls, -1 when not open
+static int gpio_fds[GPIO_MAX_PINS];
+static int gpio_fds_init = 0;
+
+int gpio_open(int gpio)
 {
-	char in[3] = {0, 0, 0};
 	char buf[50];
-	int nread, gpiofd;
+	int i, fd;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	if(!gpio_fds_init) {
+		for(i = 0; i < GPIO_MAX_PINS; i++)
+			gpio_fds[i] = -1;
+		gpio_fds_init = 1;
+	}
+	if(gpio_fds[gpio] != -1)
+		return gpio_fds[gpio];
+
 	sprintf(buf, "/sys/class/gpio/gpio%d/value", gpio);
-	gpiofd = open(buf, O_RDWR);
-	if(gpiofd < 0) {
+	fd = open(buf, O_RDWR | O_CLOEXEC);
+	if(fd < 0)
+		fd = open(buf, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
 #ifdef CTL
 		fprintf(stderr, "Failed to open gpio %d value\n", gpio);
 		perror("gpio failed");
 #endif
+		return -1;
 	}
+	gpio_fds[gpio] = fd;
+	return fd;
+}
+
+void gpio_close(int gpio)
+{
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS || !gpio_fds_init)
+		return;
+	if(gpio_fds[gpio] != -1) {
+		close(gpio_fds[gpio]);
+		gpio_fds[gpio] = -1;
+	}
+}
 
-	do {
-		nread = read(gpiofd, in, 1);
-	} while (nread == 0);
-	if(nread == -1){
+int gpio_read(int gpio)
+{
+	char in;
+	int gpiofd;
+
+	gpiofd = gpio_open(gpio);
+	if(gpiofd < 0)
+		return -1;
+
+	if(pread(gpiofd, &in, 1, 0) != 1) {
 #ifdef CTL
 		perror("GPIO Read failed");
 #endif
 		return -1;
 	}
-	
-	close(gpiofd);
-	return atoi(in);
+
+	return in == '1';
 }
 
 int gpio_write(int gpio, int val)
-{	
-	char buf[50];
-	int ret, gpiofd;
-	sprintf(buf, "/sys/class/gpio/gpio%d/value", gpio);
-	gpiofd = open(buf, O_RDWR);
-	if(gpiofd > 0) {
-		snprintf(buf, 2, "%d", val);
-		ret = write(gpiofd, buf, 2);
-		if(ret < 0) {
+{
+	int gpiofd;
+
+	gpiofd = gpio_open(gpio);
+	if(gpiofd < 0)
+		return 1;
+
+	if(pwrite(gpiofd, val ? "1" : "0", 1, 0) != 1) {
 #ifdef CTL
-			perror("failed to set gpio");
+		perror("failed to set gpio");
 #endif
-			return 1;
-		}
-
-		close(gpiofd);
-		if(ret == 2) return 0;
+		return 1;
 	}
-	return 1;
+	return 0;
 }
 
 #ifdef CTL
@@ -215,20 +266,22 @@ static void usage(char **argv) {
 	  "  -e, --setout <dio>     Sets a sysfs DIO output value high\n"
 	  "  -l, --clrout <dio>     Sets a sysfs DIO output value low\n"
 	  "  -d, --ddrout <dio>     Set sysfs DIO to an output\n"
-	  "  -r, --ddrin <dio>      Set sysfs DIO to an input\n\n",
+	  "  -r, --ddrin <dio>      Set sysfs DIO to an input\n"
+	  "  -k, --keep             Leave DIOs exported (give before other options)\n\n",
 	  argv[0]
 	);
 }
 
 int main(int argc, char **argv)
 {
-	int c;
+	int c, keep = 0;
 	static struct option long_options[] = {
 	  { "getin", 1, 0, 'p' },
 	  { "setout", 1, 0, 'e' },
 	  { "clrout", 1, 0, 'l' },
 	  { "ddrout", 1, 0, 'd' },
 	  { "ddrin", 1, 0, 'r' },
+	  { "keep", 0, 0, 'k' },
 	  { "help", 0, 0, 'h' },
 	  { 0, 0, 0, 0 }
 	};
@@ -238,39 +291,47 @@ int main(int argc, char **argv)
 		return(1);
 	}
 
-	while((c = getopt_long(argc, argv, "p:e:l:d:r:", long_options, NULL)) != -1) {
-		int gpio, i;
+	while((c = getopt_long(argc, argv, "p:e:l:d:r:k", long_options, NULL)) != -1) {
+		int gpio, i, owned;
 
 		switch(c) {
 		case 'p':
 			gpio = atoi(optarg);
-			gpio_export(gpio);
+			owned = gpio_claim(gpio);
 			printf("gpio%d=%d\n", gpio, gpio_read(gpio));
-			gpio_unexport(gpio);
+			if(owned == 1 && !keep)
+				gpio_unexport(gpio);
 			break;
 		case 'e':
 			gpio = atoi(optarg);
-			gpio_export(gpio);
+			owned = gpio_claim(gpio);
 			gpio_write(gpio, 1);
-			gpio_unexport(gpio);
+			if(owned == 1 && !keep)
+				gpio_unexport(gpio);
 			break;
 		case 'l':
 			gpio = atoi(optarg);
-			gpio_export(gpio);
+			owned = gpio_claim(gpio);
 			gpio_write(gpio, 0);
-			gpio_unexport(gpio);
+			if(owned == 1 && !keep)
+				gpio_unexport(gpio);
 			break;
 		case 'd':
 			gpio = atoi(optarg);
-			gpio_export(gpio);
+			owned = gpio_claim(gpio);
 			gpio_direction(gpio, 1);
-			gpio_unexport(gpio);
+			if(owned == 1 && !keep)
+				gpio_unexport(gpio);
 			break;
 		case 'r':
 			gpio = atoi(optarg);
-			gpio_export(gpio);
+			owned = gpio_claim(gpio);
 			gpio_direction(gpio, 0);
-			gpio_unexport(gpio);
+			if(owned == 1 && !keep)
+				gpio_unexport(gpio);
+			break;
+		case 'k':
+			keep = 1;
 			break;
 		case 'h':
 		default:
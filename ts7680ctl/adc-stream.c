@@ -0,0 +1,283 @@
+/********************************************************************************/
+// adc-stream.c
+//	Fixed-rate ADC acquisition into a ring, written out as binary or CSV
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "adc.h"
+#include "adc-stream.h"
+
+#define DRAIN_INTERVAL_MS	10
+
+struct slot {
+	uint64_t ns;
+	uint32_t seq;
+	uint16_t codes[ADC_CHANNELS];
+};
+
+struct adc_stream {
+	struct adc_dev *adc;
+	unsigned mask;
+	unsigned rate_hz;
+	uint64_t period_ns;
+	uint64_t start;
+	uint64_t end;			// 0 to run until stopped
+	pthread_t thread;
+	int running;
+
+	// Single-producer/single-consumer ring
+	struct slot *ring;
+	uint32_t size_mask;
+	uint32_t head;			// written by the sampler only
+	uint32_t tail;			// written by the drainer only
+
+	// Sampler only until it has been joined
+	unsigned long missed;
+	unsigned long dropped;
+	unsigned long errors;
+	int64_t late_max_ns;
+	int realtime;
+	// Drainer only
+	unsigned long frames;
+};
+
+static volatile sig_atomic_t stop_requested;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000ULL, ns % 1000000000ULL };
+
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+struct adc_stream *adc_stream_new(struct adc_dev *adc, unsigned mask,
+  unsigned rate_hz, unsigned ring_frames)
+{
+	struct adc_stream *s;
+	unsigned size = 2;
+
+	if(!mask || mask & ~((1U << ADC_CHANNELS) - 1) || !rate_hz ||
+	  rate_hz > ADC_STREAM_MAX_RATE || ring_frames > ADC_STREAM_MAX_RING) {
+		errno = EINVAL;
+		return NULL;
+	}
+	while(size < ring_frames)
+		size <<= 1;
+	s = calloc(1, sizeof(*s));
+	if(!s)
+		return NULL;
+	s->ring = calloc(size, sizeof(*s->ring));
+	if(!s->ring) {
+		free(s);
+		return NULL;
+	}
+	s->size_mask = size - 1;
+	s->adc = adc;
+	s->mask = mask;
+	s->rate_hz = rate_hz;
+	s->period_ns = 1000000000ULL / rate_hz;
+	return s;
+}
+
+void adc_stream_free(struct adc_stream *s)
+{
+	if(!s)
+		return;
+	free(s->ring);
+	free(s);
+}
+
+static void *stream_thread(void *arg)
+{
+	struct adc_stream *s = arg;
+	uint64_t deadline = s->start, now, n;
+	uint32_t seq = 0, head;
+	int codes[ADC_CHANNELS];
+	struct slot *slot;
+	struct sched_param sp;
+	int64_t late;
+	int i;
+
+	// If this fails the sampler keeps the default policy; see
+	// ADC_STREAM_PRIORITY
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = ADC_STREAM_PRIORITY;
+	s->realtime = !pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+
+	while(__atomic_load_n(&s->running, __ATOMIC_ACQUIRE) &&
+	  (!s->end || deadline < s->end)) {
+		sleep_until(deadline);
+		now = now_ns();
+		late = now - deadline;
+		if(late > s->late_max_ns)
+			s->late_max_ns = late;
+
+		if(adc_read_mask(s->adc, s->mask, codes)) {
+			s->errors++;
+		} else {
+			head = s->head;
+			if(head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) > s->size_mask) {
+				s->dropped++;
+			} else {
+				slot = &s->ring[head & s->size_mask];
+				slot->ns = now - s->start;
+				slot->seq = seq;
+				for(i = 0; i < ADC_CHANNELS; i++)
+					slot->codes[i] = (s->mask >> i) & 1 ? codes[i] : 0;
+				__atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+			}
+		}
+
+		// Periods that have already gone by are skipped, not bunched up
+		deadline += s->period_ns;
+		seq++;
+		now = now_ns();
+		if(now > deadline) {
+			n = (now - deadline) / s->period_ns;
+			s->missed += n;
+			deadline += n * s->period_ns;
+			seq += n;
+		}
+	}
+	return NULL;
+}
+
+static int write_header(struct adc_stream *s, FILE *out, int format)
+{
+	struct adc_stream_header h;
+	int i;
+
+	if(format == ADC_STREAM_CSV) {
+		fprintf(out, "seq,ns");
+		for(i = 0; i < ADC_CHANNELS; i++) {
+			if((s->mask >> i) & 1)
+				fprintf(out, ",adc%d", i);
+		}
+		fputc('\n', out);
+		return ferror(out) ? -1 : 0;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ADC_STREAM_MAGIC, sizeof(h.magic));
+	h.version = ADC_STREAM_VERSION;
+	h.mask = s->mask;
+	h.rate_hz = s->rate_hz;
+	h.start_hi = s->start >> 32;
+	h.start_lo = s->start;
+	return fwrite(&h, sizeof(h), 1, out) == 1 ? 0 : -1;
+}
+
+static int write_frame(struct adc_stream *s, FILE *out, int format,
+  const struct slot *slot)
+{
+	struct adc_stream_frame f;
+	uint16_t codes[ADC_CHANNELS];
+	int i, n = 0;
+
+	if(format == ADC_STREAM_CSV) {
+		fprintf(out, "%u,%llu", slot->seq, (unsigned long long)slot->ns);
+		for(i = 0; i < ADC_CHANNELS; i++) {
+			if((s->mask >> i) & 1)
+				fprintf(out, ",%u", slot->codes[i]);
+		}
+		fputc('\n', out);
+		return ferror(out) ? -1 : 0;
+	}
+	f.ns_hi = slot->ns >> 32;
+	f.ns_lo = slot->ns;
+	f.seq = slot->seq;
+	for(i = 0; i < ADC_CHANNELS; i++) {
+		if((s->mask >> i) & 1)
+			codes[n++] = slot->codes[i];
+	}
+	if(n & 1)
+		codes[n++] = 0;
+	if(fwrite(&f, sizeof(f), 1, out) != 1 ||
+	  fwrite(codes, sizeof(codes[0]), n, out) != (size_t)n)
+		return -1;
+	return 0;
+}
+
+static int drain(struct adc_stream *s, FILE *out, int format)
+{
+	uint32_t tail = s->tail;
+	uint32_t head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+	int ret = 0;
+
+	while(tail != head) {
+		if(write_frame(s, out, format, &s->ring[tail & s->size_mask]))
+			ret = -1;
+		else
+			s->frames++;
+		tail++;
+	}
+	__atomic_store_n(&s->tail, tail, __ATOMIC_RELEASE);
+	return ret;
+}
+
+int adc_stream_run(struct adc_stream *s, FILE *out, int format,
+  unsigned duration_ms)
+{
+	uint64_t now;
+	int ret = 0;
+
+	stop_requested = 0;
+	// Let the first period start after the thread is up
+	s->start = now_ns() + s->period_ns;
+	s->end = duration_ms ? s->start + (uint64_t)duration_ms * 1000000 : 0;
+	if(write_header(s, out, format))
+		return -1;
+
+	s->running = 1;
+	if(pthread_create(&s->thread, NULL, stream_thread, s)) {
+		s->running = 0;
+		return -1;
+	}
+	for(;;) {
+		now = now_ns();
+		if(stop_requested || (s->end && now >= s->end))
+			break;
+		sleep_until(now + DRAIN_INTERVAL_MS * 1000000ULL);
+		if(drain(s, out, format))
+			ret = -1;
+	}
+	__atomic_store_n(&s->running, 0, __ATOMIC_RELEASE);
+	pthread_join(s->thread, NULL);
+	if(drain(s, out, format) || fflush(out))
+		ret = -1;
+	return ret;
+}
+
+void adc_stream_stop(void)
+{
+	stop_requested = 1;
+}
+
+void adc_stream_get_stats(struct adc_stream *s, struct adc_stream_stats *st)
+{
+	st->frames = s->frames;
+	st->missed = s->missed;
+	st->dropped = s->dropped;
+	st->errors = s->errors;
+	st->late_max_ns = s->late_max_ns;
+	st->realtime = s->realtime;
+}
@@ -0,0 +1,78 @@
+#ifndef _ADC_STREAM_H_
+#define _ADC_STREAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "adc.h"
+
+// Continuous ADC acquisition.  A sampler thread reads the selected
+// channels in one pass per period, on an absolute CLOCK_MONOTONIC
+// schedule, into a preallocated ring; the calling thread drains the ring
+// to a file as packed binary frames or CSV.
+
+#define ADC_STREAM_MAGIC	"TSADCS1"
+#define ADC_STREAM_VERSION	1
+
+#define ADC_STREAM_BINARY	0
+#define ADC_STREAM_CSV		1
+
+// The sampler wakes up once per period; past 10 kHz the ARM926 would spend
+// the whole period getting there and back.  Rings are capped so a frame
+// count can't overflow the power-of-two rounding.
+#define ADC_STREAM_MAX_RATE	10000
+#define ADC_STREAM_MAX_RING	(1U << 20)
+
+// The sampler asks for SCHED_FIFO at this priority so it gets the single
+// ARM9 core ahead of the control task, below the kernel's threaded IRQs
+// at 50.  That needs root, CAP_SYS_NICE or an RLIMIT_RTPRIO allowance;
+// without one the sampler runs at normal priority and late wakeups show
+// up as missed periods.
+#define ADC_STREAM_PRIORITY	20
+
+struct adc_stream_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t mask;			// channels in each frame, ascending
+	uint32_t rate_hz;
+	uint32_t start_hi;		// CLOCK_MONOTONIC ns at the first period
+	uint32_t start_lo;
+	uint32_t reserved;
+};
+
+// Followed by one uint16_t raw code per channel in mask, padded with a
+// zero code to an even count so frames stay 32-bit aligned
+struct adc_stream_frame {
+	uint32_t ns_hi;			// ns since the start, taken at the read
+	uint32_t ns_lo;
+	uint32_t seq;			// period number; a gap is a missed
+					// deadline or a frame lost to a full ring
+};
+
+struct adc_stream_stats {
+	unsigned long frames;		// frames written out
+	unsigned long missed;		// periods skipped because a read ran late
+	unsigned long dropped;		// frames lost to a full ring
+	unsigned long errors;		// failed conversions
+	int64_t late_max_ns;		// worst wakeup lateness against the deadline
+	int realtime;			// sampler got SCHED_FIFO
+};
+
+struct adc_stream;
+
+// rate_hz from 1 to ADC_STREAM_MAX_RATE; ring_frames up to
+// ADC_STREAM_MAX_RING, rounded up to a power of two.  NULL with EINVAL for
+// anything out of range.
+struct adc_stream *adc_stream_new(struct adc_dev *adc, unsigned mask,
+  unsigned rate_hz, unsigned ring_frames);
+void adc_stream_free(struct adc_stream *s);
+// Samples for duration_ms, or until adc_stream_stop() if 0, writing frames
+// to out as they arrive
+int adc_stream_run(struct adc_stream *s, FILE *out, int format,
+  unsigned duration_ms);
+// Async-signal-safe
+void adc_stream_stop(void);
+// Complete once adc_stream_run() has returned
+void adc_stream_get_stats(struct adc_stream *s, struct adc_stream_stats *st);
+
+#endif //_ADC_STREAM_H_
@@ -0,0 +1,641 @@
+/********************************************************************************/
+// adc.c
+//	LRADC and HSADC analog inputs for the TS-7680
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "adc.h"
+#include "reg-wait.h"
+
+// Every register has SET/CLR aliases that update only the bits written
+#define REG_SET			0x04
+#define REG_CLR			0x08
+
+// LRADC register offsets in bytes
+#define LRADC_CTRL0_SET		0x04
+#define LRADC_CTRL1		0x10
+#define LRADC_CTRL1_CLR		0x18
+#define LRADC_CTRL2		0x28
+#define LRADC_CH(n)		(0x50 + (n) * 0x10)
+#define LRADC_DELAY(n)		(0xd0 + (n) * 0x10)
+#define LRADC_SET		0x04
+#define LRADC_CTRL4_SET		0x144
+#define LRADC_CTRL4_CLR		0x148
+
+// Channel register: results accumulate over NUM_SAMPLES + 1 conversions
+#define LRADC_CH_ACCUMULATE	(1 << 29)
+#define LRADC_CH_NUM_SAMPLES(n)	((n) << 24)
+#define LRADC_VALUE		0x3ffff
+
+// Delay channel register: after DELAY ticks of the 2 kHz clock, trigger
+// the LRADCs in TRIGGER, then repeat LOOP_COUNT more times
+#define LRADC_DELAY_TRIGGER(m)	((m) << 24)
+#define LRADC_DELAY_KICK	(1 << 20)
+#define LRADC_DELAY_LOOP(n)	((n) << 11)
+#define LRADC_DELAY_DELAY(n)	(n)
+
+#define LRADC_INPUTS		7
+#define LRADC_DELAYS		4
+#define LRADC_ROUNDS		10	// temperature sense, in software
+
+// HSADC register offsets in bytes
+#define HSADC_CTRL0		0x00
+#define HSADC_CTRL0_SET		0x04
+#define HSADC_CTRL0_CLR		0x08
+#define HSADC_CTRL1		0x10
+#define HSADC_CTRL1_SET		0x14
+#define HSADC_CTRL2_SET		0x24
+#define HSADC_CTRL2_CLR		0x28
+#define HSADC_SEQ_SAMPLES	0x30
+#define HSADC_SEQ_NUM		0x40
+#define HSADC_FIFO		0x50
+
+#define HSADC_CTRL1_IRQ_CLR	0xfc000000	// write 1s to clear the interrupts
+#define HSADC_CTRL1_IRQ		0x1		// conversion done
+
+#define HSADC_SAMPLES		10	// two 12-bit samples per FIFO word
+#define HSADC_FIFO_DRAIN	256	// reads before giving up on an empty FIFO
+
+// CLKCTRL register offsets in bytes
+#define CLKCTRL_FRAC1_CLR	0x1c8
+#define CLKCTRL_HSADC		0x154
+
+// mV per code of an LRADC input in the 1.8 V range with divide by two, the
+// setup adc_code_to_mv() expects
+#define LRADC_MV_PER_CODE	(1800.0 * 2 / 4096)
+
+enum { LRADC_UNSET, LRADC_INPUT_MODE, LRADC_TEMP_MODE };
+
+static char iio_root[64] = "/sys/bus/iio/devices";
+
+struct adc_dev {
+	int fd;
+	long page;
+	int emulate;		// a plain file stands in for the registers
+	volatile uint32_t *lradc;
+	volatile uint32_t *hsadc;
+	volatile uint32_t *clkctrl;
+	int lradc_mode;		// what the LRADC channels are assigned to
+	int oversample[LRADC_INPUTS];
+	struct reg_wait lradc_wait;
+	struct reg_wait hsadc_wait;
+	struct reg_wait temp_wait;
+	// LRADC inputs read through the kernel's mxs-lradc IIO driver, which
+	// sleeps on the conversion interrupt.  -1 where not available.
+	int iio_fd[LRADC_INPUTS];
+	double iio_scale[LRADC_INPUTS];	// mV per raw count
+	int iio_temp_fd;
+	double iio_temp_scale, iio_temp_offset;
+};
+
+void adc_set_iio_root(const char *root)
+{
+	snprintf(iio_root, sizeof(iio_root), "%s", root ? root : "");
+}
+
+static int read_attr(const char *dir, const char *attr, char *buf, int len)
+{
+	char path[384];
+	int fd, n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if(n <= 0)
+		return -1;
+	buf[n] = 0;
+	return 0;
+}
+
+static int open_attr(const char *dir, const char *attr)
+{
+	char path[384];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Finds the mxs-lradc IIO device and opens its raw value attributes once
+static void iio_open(struct adc_dev *adc)
+{
+	char dir[sizeof(iio_root) + 256], attr[32], buf[64];
+	struct dirent *de;
+	DIR *d;
+	int i;
+
+	if(!iio_root[0] || !(d = opendir(iio_root)))
+		return;
+	while((de = readdir(d))) {
+		if(strncmp(de->d_name, "iio:device", 10))
+			continue;
+		snprintf(dir, sizeof(dir), "%s/%s", iio_root, de->d_name);
+		if(read_attr(dir, "name", buf, sizeof(buf)) == 0 &&
+		  !strncmp(buf, "mxs-lradc", 9))
+			break;
+	}
+	closedir(d);
+	if(!de)
+		return;
+
+	for(i = 0; i < LRADC_INPUTS; i++) {
+		snprintf(attr, sizeof(attr), "in_voltage%d_scale", i);
+		if(read_attr(dir, attr, buf, sizeof(buf)))
+			continue;
+		adc->iio_scale[i] = atof(buf);
+		snprintf(attr, sizeof(attr), "in_voltage%d_raw", i);
+		adc->iio_fd[i] = open_attr(dir, attr);
+	}
+	if(read_attr(dir, "in_temp8_scale", buf, sizeof(buf)) == 0) {
+		adc->iio_temp_scale = atof(buf);
+		if(read_attr(dir, "in_temp8_offset", buf, sizeof(buf)) == 0)
+			adc->iio_temp_offset = atof(buf);
+		adc->iio_temp_fd = open_attr(dir, "in_temp8_raw");
+	}
+}
+
+static int iio_read(int fd, int *val)
+{
+	char buf[32];
+	int n;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if(n <= 0)
+		return -1;
+	buf[n] = 0;
+	*val = atoi(buf);
+	return 0;
+}
+
+static int iio_inputs(struct adc_dev *adc)
+{
+	unsigned mask = 0;
+	int i;
+
+	for(i = 0; i < LRADC_INPUTS; i++) {
+		if(adc->iio_fd[i] >= 0)
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
+static volatile uint32_t *map_block(struct adc_dev *adc, off_t off)
+{
+	void *p;
+
+	p = mmap(NULL, adc->page, PROT_READ | PROT_WRITE, MAP_SHARED, adc->fd, off);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void unmap_block(struct adc_dev *adc, volatile uint32_t *regs)
+{
+	if(regs)
+		munmap((void *)regs, adc->page);
+}
+
+// off is the SET or CLR alias.  A plain file has no SET/CLR hardware
+// behind it, so do the same update on the register itself; that keeps a
+// clear ahead of the conversion it is for, as the hardware does.
+static void reg_set(struct adc_dev *adc, volatile uint32_t *r, int off,
+  uint32_t bits)
+{
+	if(adc->emulate)
+		__atomic_fetch_or(&r[(off - REG_SET)/4], bits, __ATOMIC_SEQ_CST);
+	else
+		r[off/4] = bits;
+}
+
+static void reg_clr(struct adc_dev *adc, volatile uint32_t *r, int off,
+  uint32_t bits)
+{
+	if(adc->emulate)
+		__atomic_fetch_and(&r[(off - REG_CLR)/4], ~bits, __ATOMIC_SEQ_CST);
+	else
+		r[off/4] = bits;
+}
+
+static void hsadc_clear_irq(struct adc_dev *adc)
+{
+	volatile uint32_t *r = adc->hsadc;
+
+	if(adc->emulate)
+		__atomic_fetch_and(&r[HSADC_CTRL1/4], ~HSADC_CTRL1_IRQ, __ATOMIC_SEQ_CST);
+	else
+		r[HSADC_CTRL1_SET/4] = HSADC_CTRL1_IRQ_CLR;
+}
+
+static void lradc_input_mode(struct adc_dev *adc)
+{
+	volatile uint32_t *r = adc->lradc;
+	int i;
+
+	if(adc->lradc_mode == LRADC_INPUT_MODE)
+		return;
+	reg_clr(adc, r, LRADC_CTRL4_CLR, 0xfffffff); //Clears LRADC6:0 assignments
+	reg_set(adc, r, LRADC_CTRL4_SET, 0x6543210); //set LRADC6:0 to channel 6:0
+	r[LRADC_CTRL2/4] = 0xff000000; //set 1.8V Range
+	for(i = 0; i < LRADC_INPUTS; i++)
+		r[LRADC_CH(i)/4] = 0x0; //Clear LRADCx reg
+	adc->lradc_mode = LRADC_INPUT_MODE;
+}
+
+static void lradc_temp_mode(struct adc_dev *adc)
+{
+	volatile uint32_t *r = adc->lradc;
+
+	if(adc->lradc_mode == LRADC_TEMP_MODE)
+		return;
+	reg_clr(adc, r, LRADC_CTRL4_CLR, 0xff);
+	reg_set(adc, r, LRADC_CTRL4_SET, 0x98); //Set to temp sense mode
+	r[LRADC_CTRL2/4] = 0x8300; //Enable temp sense block
+	r[LRADC_CH(0)/4] = 0x0; //Clear ch0 reg
+	r[LRADC_CH(1)/4] = 0x0; //Clear ch1 reg
+	adc->lradc_mode = LRADC_TEMP_MODE;
+}
+
+static int hsadc_drain(volatile uint32_t *r)
+{
+	int i;
+
+	for(i = 0; i < HSADC_FIFO_DRAIN; i++) {
+		if(r[HSADC_CTRL1/4] & 0x20)
+			return 0;
+		r[HSADC_FIFO/4]; //Empty FIFO
+	}
+	errno = EIO;
+	return -1;
+}
+
+// One-time HSADC bring up, including the reset sequence
+static void hsadc_init(struct adc_dev *adc)
+{
+	volatile uint32_t *r = adc->hsadc;
+	volatile uint32_t *clk = adc->clkctrl;
+
+	//See if the HSADC needs to be brought out of reset
+	if(r[HSADC_CTRL0/4] & 0xc0000000) {
+		clk[CLKCTRL_HSADC/4] = 0x70000000;
+		reg_clr(adc, clk, CLKCTRL_FRAC1_CLR, 0x8000);
+		//ENGR116296 errata workaround
+		reg_clr(adc, r, HSADC_CTRL0_CLR, 0x80000000);
+		r[HSADC_CTRL0/4] = ((r[HSADC_CTRL0/4] | 0x80000000) & (~0x40000000));
+		reg_set(adc, r, HSADC_CTRL0_SET, 0x40000000);
+		reg_clr(adc, r, HSADC_CTRL0_CLR, 0x40000000);
+		reg_set(adc, r, HSADC_CTRL0_SET, 0x40000000);
+
+		usleep(10);
+		reg_clr(adc, r, HSADC_CTRL0_CLR, 0xc0000000);
+	}
+
+	reg_clr(adc, r, HSADC_CTRL2_CLR, 0x2000); //Clear powerdown
+	reg_set(adc, r, HSADC_CTRL2_SET, 0x31); //Set precharge and SH bypass
+	r[HSADC_SEQ_SAMPLES/4] = HSADC_SAMPLES; //Set sample num
+	r[HSADC_SEQ_NUM/4] = 0x1; //Set seq num
+	reg_set(adc, r, HSADC_CTRL0_SET, 0x40000); //12bit mode
+
+	hsadc_drain(r);
+	r[HSADC_FIFO/4]; //An extra read is necessary
+
+	hsadc_clear_irq(adc);
+	reg_set(adc, r, HSADC_CTRL0_SET, 0x1); //Set HS_RUN
+	usleep(10);
+}
+
+struct adc_dev *adc_open(const char *path)
+{
+	struct adc_dev *adc;
+	struct stat st;
+	off_t lr = ADC_LRADC_BASE, hs = ADC_HSADC_BASE, clk = ADC_CLKCTRL_BASE;
+	int i;
+
+	adc = calloc(1, sizeof(*adc));
+	if(!adc)
+		return NULL;
+	adc->page = getpagesize();
+	adc->iio_temp_fd = -1;
+	for(i = 0; i < LRADC_INPUTS; i++) {
+		adc->iio_fd[i] = -1;
+		adc->oversample[i] = ADC_OVERSAMPLE_DEFAULT;
+	}
+	reg_wait_init(&adc->lradc_wait, 0);
+	reg_wait_init(&adc->hsadc_wait, 0);
+	reg_wait_init(&adc->temp_wait, 0);
+	// Only the real hardware can have a kernel driver in front of it
+	if(!path)
+		iio_open(adc);
+
+	adc->fd = open(path ? path : "/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
+	// The driver alone is enough for the LRADC inputs, without root
+	if(adc->fd < 0 && iio_inputs(adc) == (1U << LRADC_INPUTS) - 1)
+		return adc;
+	if(adc->fd < 0 || fstat(adc->fd, &st)) {
+		perror(path ? path : "/dev/mem");
+		goto fail;
+	}
+	if(S_ISREG(st.st_mode)) {
+		adc->emulate = 1;
+		lr = 0;
+		hs = adc->page;
+		clk = adc->page * 2;
+		if(st.st_size < clk + adc->page && ftruncate(adc->fd, clk + adc->page)) {
+			perror(path);
+			goto fail;
+		}
+	}
+
+	adc->lradc = map_block(adc, lr);
+	adc->hsadc = map_block(adc, hs);
+	adc->clkctrl = map_block(adc, clk);
+	if(!adc->lradc || !adc->hsadc || !adc->clkctrl) {
+		perror("mmap");
+		goto fail;
+	}
+
+	// Leave the LRADC to the driver when it has every input
+	if(iio_inputs(adc) != (1U << LRADC_INPUTS) - 1)
+		lradc_input_mode(adc);
+	hsadc_init(adc);
+	return adc;
+
+fail:
+	adc_close(adc);
+	return NULL;
+}
+
+void adc_close(struct adc_dev *adc)
+{
+	int i;
+
+	if(!adc)
+		return;
+	unmap_block(adc, adc->lradc);
+	unmap_block(adc, adc->hsadc);
+	unmap_block(adc, adc->clkctrl);
+	if(adc->fd >= 0)
+		close(adc->fd);
+	for(i = 0; i < LRADC_INPUTS; i++) {
+		if(adc->iio_fd[i] >= 0)
+			close(adc->iio_fd[i]);
+	}
+	if(adc->iio_temp_fd >= 0)
+		close(adc->iio_temp_fd);
+	free(adc);
+}
+
+// Converts the LRADC inputs in mask, each summing its oversample count in
+// hardware.  Inputs with the same count share a delay channel that
+// triggers them count times in a row; inputs taking a single sample are
+// scheduled directly.  Everything starts together and the CPU only waits
+// for the completion bits.  More distinct counts than delay channels take
+// more than one pass.
+static int lradc_convert(struct adc_dev *adc, unsigned mask, int codes[LRADC_INPUTS])
+{
+	volatile uint32_t *r = adc->lradc;
+	unsigned group[LRADC_DELAYS], pass, direct;
+	int count[LRADC_DELAYS];
+	int i, d, n, ngroups;
+
+	lradc_input_mode(adc);
+	while(mask) {
+		ngroups = 0;
+		pass = direct = 0;
+		for(i = 0; i < LRADC_INPUTS; i++) {
+			if(!(mask & (1U << i)))
+				continue;
+			n = adc->oversample[i];
+			if(n == 1) {
+				direct |= 1U << i;
+				pass |= 1U << i;
+				continue;
+			}
+			for(d = 0; d < ngroups && count[d] != n; d++)
+				;
+			if(d == LRADC_DELAYS)
+				continue;
+			if(d == ngroups) {
+				count[d] = n;
+				group[d] = 0;
+				ngroups++;
+			}
+			group[d] |= 1U << i;
+			pass |= 1U << i;
+		}
+
+		reg_clr(adc, r, LRADC_CTRL1_CLR, pass); //Clear interrupt ready
+		for(i = 0; i < LRADC_INPUTS; i++) {
+			if(!(pass & (1U << i)))
+				continue;
+			n = adc->oversample[i];
+			// Also clears the previous result
+			r[LRADC_CH(i)/4] = n > 1 ?
+			  LRADC_CH_ACCUMULATE | LRADC_CH_NUM_SAMPLES(n - 1) : 0;
+		}
+		for(d = 0; d < ngroups; d++) {
+			r[LRADC_DELAY(d)/4] = LRADC_DELAY_TRIGGER(group[d]) |
+			  LRADC_DELAY_LOOP(count[d] - 1) | LRADC_DELAY_DELAY(1);
+		}
+		for(d = 0; d < ngroups; d++)
+			reg_set(adc, r, LRADC_DELAY(d) + LRADC_SET, LRADC_DELAY_KICK);
+		if(direct)
+			reg_set(adc, r, LRADC_CTRL0_SET, direct); //Schedule conversion
+		if(reg_wait(&adc->lradc_wait, &r[LRADC_CTRL1/4], pass, pass))
+			return -1;
+
+		for(i = 0; i < LRADC_INPUTS; i++) {
+			if(pass & (1U << i))
+				codes[i] = (r[LRADC_CH(i)/4] & LRADC_VALUE) / adc->oversample[i];
+		}
+		mask &= ~pass;
+	}
+	return 0;
+}
+
+// Reads the LRADC inputs in mask from the IIO driver
+static int lradc_iio_convert(struct adc_dev *adc, unsigned mask, int codes[LRADC_INPUTS])
+{
+	int i, raw;
+
+	for(i = 0; i < LRADC_INPUTS; i++) {
+		if(!(mask & (1U << i)))
+			continue;
+		if(iio_read(adc->iio_fd[i], &raw))
+			return -1;
+		codes[i] = raw * adc->iio_scale[i] / LRADC_MV_PER_CODE + 0.5;
+	}
+	return 0;
+}
+
+// Sums one HSADC_SAMPLES sequence
+static int hsadc_convert(struct adc_dev *adc, unsigned long long *sum)
+{
+	volatile uint32_t *r = adc->hsadc;
+	uint32_t x;
+	int i;
+
+	if(!(r[HSADC_CTRL0/4] & 0x1)) {
+		reg_set(adc, r, HSADC_CTRL0_SET, 0x1); //Set HS_RUN
+		usleep(10);
+	}
+	if(hsadc_drain(r))
+		return -1;
+	hsadc_clear_irq(adc);
+	reg_set(adc, r, HSADC_CTRL0_SET, 0x08000000); //Start conversion
+	if(reg_wait(&adc->hsadc_wait, &r[HSADC_CTRL1/4], HSADC_CTRL1_IRQ,
+	  HSADC_CTRL1_IRQ))
+		return -1;
+
+	*sum = 0;
+	for(i = 0; i < HSADC_SAMPLES / 2; i++) {
+		x = r[HSADC_FIFO/4];
+		*sum += (x & 0xfff) + ((x >> 16) & 0xfff);
+	}
+	return 0;
+}
+
+void adc_set_timeout(struct adc_dev *adc, unsigned ms)
+{
+	adc->lradc_wait.timeout_us = ms * 1000;
+	adc->hsadc_wait.timeout_us = ms * 1000;
+	adc->temp_wait.timeout_us = ms * 1000;
+}
+
+int adc_set_oversample(struct adc_dev *adc, int ch, int samples)
+{
+	unsigned iio = 0;
+	int i;
+
+	if(samples < 1 || samples > ADC_OVERSAMPLE_MAX || ch < -1 || ch >= LRADC_INPUTS)
+		return -1;
+	for(i = 0; i < LRADC_INPUTS; i++) {
+		if(ch == -1 || ch == i) {
+			adc->oversample[i] = samples;
+			if(adc->iio_fd[i] >= 0)
+				iio |= 1U << i;
+		}
+	}
+	// The mxs-lradc driver has no oversampling control, and its raw
+	// attribute is a single conversion
+	if(samples > 1 && iio) {
+		fprintf(stderr, "Warning: oversampling of %d ignored on the IIO "
+		  "driver's LRADC inputs:", samples);
+		for(i = 0; i < LRADC_INPUTS; i++) {
+			if(iio & (1U << i))
+				fprintf(stderr, " %d", i);
+		}
+		fprintf(stderr, "\n");
+	}
+	return 0;
+}
+
+int adc_read_mask(struct adc_dev *adc, unsigned mask, int codes[ADC_CHANNELS])
+{
+	unsigned lmask = mask & ((1U << LRADC_INPUTS) - 1);
+	unsigned iio = lmask & iio_inputs(adc);
+	unsigned long long sum;
+
+	if(mask & ~((1U << ADC_CHANNELS) - 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(!adc->lradc && (mask & ~iio)) {
+		errno = ENODEV;
+		return -1;
+	}
+	if(iio && lradc_iio_convert(adc, iio, codes))
+		return -1;
+	if((lmask & ~iio) && lradc_convert(adc, lmask & ~iio, codes))
+		return -1;
+	if(mask & (1U << ADC_HSADC_CHANNEL)) {
+		if(hsadc_convert(adc, &sum))
+			return -1;
+		codes[ADC_HSADC_CHANNEL] = sum / HSADC_SAMPLES;
+	}
+	return 0;
+}
+
+int adc_read_all(struct adc_dev *adc, int codes[ADC_CHANNELS])
+{
+	return adc_read_mask(adc, (1U << ADC_CHANNELS) - 1, codes);
+}
+
+int adc_read(struct adc_dev *adc, int ch)
+{
+	int codes[ADC_CHANNELS];
+
+	if(ch < 0 || ch >= ADC_CHANNELS || adc_read_mask(adc, 1U << ch, codes))
+		return -1;
+	return codes[ch];
+}
+
+int adc_code_to_mv(unsigned code)
+{
+	return ((unsigned long long)code * 45177 * 6235) / 100000000;
+}
+
+int adc_read_mv(struct adc_dev *adc, int ch)
+{
+	int code = adc_read(adc, ch);
+
+	return code < 0 ? -1 : adc_code_to_mv(code);
+}
+
+int adc_code_to_ma(unsigned code)
+{
+	return adc_code_to_mv(code) * 1000 / 240;
+}
+
+int adc_read_ma(struct adc_dev *adc, int ch)
+{
+	int code = adc_read(adc, ch);
+
+	return code < 0 ? -1 : adc_code_to_ma(code);
+}
+
+int adc_cputemp(struct adc_dev *adc, int *temp)
+{
+	volatile uint32_t *r = adc->lradc;
+	int t[2] = {0, 0};
+	int x;
+
+	if(adc->iio_temp_fd >= 0) {
+		// millidegrees from the driver
+		if(iio_read(adc->iio_temp_fd, &x))
+			return -1;
+		*temp = (x + adc->iio_temp_offset) * adc->iio_temp_scale * 10;
+		return 0;
+	}
+	if(!r) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	lradc_temp_mode(adc);
+	for(x = 0; x < LRADC_ROUNDS; x++) {
+		/* Clear interrupts
+		 * Schedule readings
+		 * Poll for samples completion
+		 * Pull out samples */
+		reg_clr(adc, r, LRADC_CTRL1_CLR, 0x3);
+		reg_set(adc, r, LRADC_CTRL0_SET, 0x3);
+		if(reg_wait(&adc->temp_wait, &r[LRADC_CTRL1/4], 0x3, 0x3))
+			return -1;
+		t[0] += r[LRADC_CH(1)/4] & LRADC_VALUE;
+		t[1] += r[LRADC_CH(0)/4] & LRADC_VALUE;
+	}
+	*temp = ((t[0] - t[1]) * (1012/4)) - 2730000;
+	return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef _ADC_H_
+#define _ADC_H_
+
+// i.MX28 analog inputs.  Channels 0-6 are LRADC inputs, channel 7 is the
+// HSADC.  adc_open() maps the LRADC, HSADC and CLKCTRL blocks once and
+// brings the converters up, so each read after that only schedules a
+// conversion and collects the results.
+
+#define ADC_CHANNELS		8
+#define ADC_HSADC_CHANNEL	7
+
+#define ADC_LRADC_BASE		0x80050000
+#define ADC_HSADC_BASE		0x80002000
+#define ADC_CLKCTRL_BASE	0x80040000
+
+// LRADC samples averaged per reading, summed by the converter itself.  The
+// delay channel paces them at 2 kHz, so a reading takes about
+// samples / 2 ms; one sample is converted straight away.
+#define ADC_OVERSAMPLE_DEFAULT	10
+#define ADC_OVERSAMPLE_MAX	32
+
+// analogInMode() modes
+#define ADC_MODE_MV		0
+#define ADC_MODE_MA		1
+
+struct adc_dev;
+
+// NULL path is /dev/mem.  A regular file stands in for the hardware with
+// the three blocks one page apart from offset 0; writes to a register's
+// SET/CLR alias are applied to the register itself.  With a NULL path, LRADC
+// inputs and the die temperature the kernel's mxs-lradc IIO driver
+// provides are read through it instead, sleeping on the conversion
+// interrupt; oversampling is then up to the driver.
+struct adc_dev *adc_open(const char *path);
+void adc_close(struct adc_dev *adc);
+// Where adc_open() looks for IIO devices; NULL to never use them
+void adc_set_iio_root(const char *root);
+// Longest wait for one conversion before a read fails with ETIMEDOUT
+// (default 100 ms)
+void adc_set_timeout(struct adc_dev *adc, unsigned ms);
+// samples from 1 to ADC_OVERSAMPLE_MAX for LRADC input ch, or every LRADC
+// input if ch is -1.  Inputs read through the IIO driver always take a
+// single sample; asking for more there prints a warning.
+int adc_set_oversample(struct adc_dev *adc, int ch, int samples);
+// Average raw codes of every channel whose bit is set in mask, from one
+// conversion pass: the LRADC inputs are converted together, the HSADC
+// only runs when channel 7 is asked for.  Other codes[] are untouched.
+// 0, or -1 with errno set.
+int adc_read_mask(struct adc_dev *adc, unsigned mask, int codes[ADC_CHANNELS]);
+int adc_read_all(struct adc_dev *adc, int codes[ADC_CHANNELS]);
+// Average raw code of one channel, or -1
+int adc_read(struct adc_dev *adc, int ch);
+int adc_read_mv(struct adc_dev *adc, int ch);
+// Input current through the 240 ohm sense resistor
+int adc_read_ma(struct adc_dev *adc, int ch);
+// SoC die temperature in units of 0.0001 C
+int adc_cputemp(struct adc_dev *adc, int *temp);
+
+int adc_code_to_mv(unsigned code);
+int adc_code_to_ma(unsigned code);
+
+#endif //_ADC_H_
@@ -0,0 +1,288 @@
+/********************************************************************************/
+// adcbench.c
+//	Checks that the ADC stream keeps its rate on every channel, against a
+//	file-backed register window with an in-process converter model
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#include "adc.h"
+#include "adc-stream.h"
+
+#define BENCH_CHANNELS	0xff
+
+/********************************************************************************/
+// Converter model.  adc.c applies its SET/CLR writes to the file's registers
+// itself, so the model only has to take the start bits as the hardware
+// clears them and complete each conversion after roughly the hardware's
+// time: a delay channel triggers its inputs once per 2 kHz tick, a direct
+// conversion or an HSADC sequence takes a few microseconds.  Between polls
+// it sleeps, so on one CPU it doesn't take the sampler's time.
+/********************************************************************************/
+
+#define LRADC_CTRL0		0x00
+#define LRADC_CTRL1		0x10
+#define LRADC_CH(n)		(0x50 + (n) * 0x10)
+#define LRADC_DELAY(n)		(0xd0 + (n) * 0x10)
+#define LRADC_DELAY_KICK	(1 << 20)
+
+#define HSADC_CTRL0		0x00
+#define HSADC_CTRL1		0x10
+#define HSADC_FIFO		0x50
+#define HSADC_START		0x08000000
+#define HSADC_IRQ		0x1
+#define HSADC_FIFO_EMPTY	0x20
+
+#define MODEL_TICK_NS		500000	// LRADC delay clock
+#define MODEL_CONVERT_NS	5000
+#define MODEL_POLL_NS		20000
+
+static volatile uint32_t *lradc, *hsadc;
+static volatile int model_stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+// Code input ch converts to
+static unsigned model_code(int ch)
+{
+	return 1000 + ch * 100;
+}
+
+// Clears bits in a register the way self-clearing hardware bits do,
+// returning the ones that were set
+static uint32_t take(volatile uint32_t *reg, uint32_t bits)
+{
+	return __atomic_fetch_and(reg, ~bits, __ATOMIC_SEQ_CST) & bits;
+}
+
+static void *model_thread(void *arg)
+{
+	uint64_t due = 0, t, wake;
+	uint32_t done = 0, cfg, direct;
+	int d, i, loops;
+
+	(void)arg;
+	while(!model_stop) {
+		t = now_ns();
+		for(d = 0; d < 4; d++) {
+			if(!take(&lradc[LRADC_DELAY(d)/4], LRADC_DELAY_KICK))
+				continue;
+			cfg = lradc[LRADC_DELAY(d)/4];
+			loops = ((cfg >> 11) & 0x1f) + 1;
+			for(i = 0; i < 7; i++) {
+				if(!(cfg >> 24 & (1U << i)))
+					continue;
+				lradc[LRADC_CH(i)/4] = (lradc[LRADC_CH(i)/4] & ~0x3ffffU) |
+				  loops * model_code(i);
+				done |= 1U << i;
+			}
+			if(due < t + loops * MODEL_TICK_NS)
+				due = t + loops * MODEL_TICK_NS;
+		}
+		direct = take(&lradc[LRADC_CTRL0/4], 0x7f);
+		if(direct) {
+			for(i = 0; i < 7; i++) {
+				if(direct & (1U << i))
+					lradc[LRADC_CH(i)/4] = model_code(i);
+			}
+			done |= direct;
+			if(due < t + MODEL_CONVERT_NS)
+				due = t + MODEL_CONVERT_NS;
+		}
+		if(done && now_ns() >= due) {
+			__atomic_fetch_or(&lradc[LRADC_CTRL1/4], done, __ATOMIC_SEQ_CST);
+			done = 0;
+			due = 0;
+		}
+
+		if(take(&hsadc[HSADC_CTRL0/4], HSADC_START)) {
+			// Every FIFO read returns the same pair of samples
+			hsadc[HSADC_FIFO/4] = model_code(ADC_HSADC_CHANNEL) << 16 |
+			  model_code(ADC_HSADC_CHANNEL);
+			__atomic_fetch_or(&hsadc[HSADC_CTRL1/4], HSADC_IRQ, __ATOMIC_SEQ_CST);
+		}
+
+		// Next poll, or the pending completion if that comes first
+		wake = t + MODEL_POLL_NS;
+		if(done && due < wake)
+			wake = due;
+		sleep_until(wake);
+	}
+	return NULL;
+}
+
+/********************************************************************************/
+
+// Reads the stream back and counts frames whose codes aren't the model's
+static long check_frames(FILE *f, unsigned mask, long *frames)
+{
+	struct adc_stream_header h;
+	struct adc_stream_frame fr;
+	uint16_t codes[ADC_CHANNELS];
+	long bad = 0;
+	int i, k, n = 0;
+
+	for(i = 0; i < ADC_CHANNELS; i++)
+		n += (mask >> i) & 1;
+	n += n & 1;
+	*frames = 0;
+	rewind(f);
+	if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, ADC_STREAM_MAGIC, 8))
+		return -1;
+	while(fread(&fr, sizeof(fr), 1, f) == 1 &&
+	  fread(codes, sizeof(codes[0]), n, f) == (size_t)n) {
+		(*frames)++;
+		for(i = 0, k = 0; i < ADC_CHANNELS; i++) {
+			if(!((mask >> i) & 1))
+				continue;
+			if(codes[k++] != model_code(i)) {
+				bad++;
+				break;
+			}
+		}
+	}
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned rate = 1000, seconds = 2;
+	int oversample = 1, codes[ADC_CHANNELS];
+	struct adc_stream_stats st;
+	struct adc_stream *s;
+	struct adc_dev *adc;
+	char path[] = "/tmp/adcbench.XXXXXX";
+	long n, iters = 1000, frames, bad, page = getpagesize();
+	pthread_t model;
+	volatile uint32_t *m;
+	uint64_t t0;
+	FILE *out;
+	int c, fd, ret = 0;
+
+	while((c = getopt(argc, argv, "r:t:o:h")) != -1) {
+		switch(c) {
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			oversample = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r hz] [-t seconds] [-o oversample]\n",
+			  argv[0]);
+			return 1;
+		}
+	}
+	if(!seconds)
+		seconds = 1;
+	// Threads inherit it: without this every short sleep, the model's
+	// polls and the reader's waits alike, runs over by the default 50 us
+	prctl(PR_SET_TIMERSLACK, 1);
+
+	fd = mkstemp(path);
+	if(fd < 0 || ftruncate(fd, 3 * page)) {
+		perror(path);
+		return 1;
+	}
+	m = mmap(NULL, 3 * page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED) {
+		perror("mmap");
+		unlink(path);
+		return 1;
+	}
+	lradc = m;
+	hsadc = m + page / 4;
+	hsadc[HSADC_CTRL1/4] = HSADC_FIFO_EMPTY;
+	pthread_create(&model, NULL, model_thread, NULL);
+
+	adc = adc_open(path);
+	if(!adc) {
+		ret = 1;
+		goto out;
+	}
+	adc_set_timeout(adc, 1000);
+	if(adc_set_oversample(adc, -1, oversample)) {
+		fprintf(stderr, "Oversample must be 1 to %d\n", ADC_OVERSAMPLE_MAX);
+		ret = 1;
+		goto out;
+	}
+	printf("ADC model: channels 0x%02x, oversample %d, %u Hz for %u s\n",
+	  BENCH_CHANNELS, oversample, rate, seconds);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++) {
+		if(adc_read_mask(adc, BENCH_CHANNELS, codes)) {
+			perror("adc_read_mask");
+			ret = 1;
+			goto out;
+		}
+	}
+	printf("%-20s %10.1f us/read\n", "read  all channels",
+	  (now_ns() - t0) / 1e3 / iters);
+
+	s = adc_stream_new(adc, BENCH_CHANNELS, rate, rate);
+	out = tmpfile();
+	if(!s || !out) {
+		perror("stream");
+		adc_stream_free(s);
+		ret = 1;
+		goto out;
+	}
+	if(adc_stream_run(s, out, ADC_STREAM_BINARY, seconds * 1000))
+		ret = 1;
+	adc_stream_get_stats(s, &st);
+	bad = check_frames(out, BENCH_CHANNELS, &frames);
+	fclose(out);
+	adc_stream_free(s);
+
+	printf("%-20s %10ld frames %6lu missed %6lu dropped %6lu errors %6ld wrong"
+	  " %8.1f us late max%s\n", "stream", frames, st.missed, st.dropped,
+	  st.errors, bad, st.late_max_ns / 1e3, st.realtime ? ", SCHED_FIFO" : "");
+	// A stream that can't hold its rate, or reads wrong codes, fails
+	if(bad || st.errors || st.dropped ||
+	  frames < (long)rate * seconds - (long)rate * seconds / 100) {
+		printf("FAIL: %u Hz not sustained\n", rate);
+		ret = 1;
+	}
+
+out:
+	model_stop = 1;
+	pthread_join(model, NULL);
+	adc_close(adc);
+	munmap((void *)m, 3 * page);
+	unlink(path);
+	return ret;
+}
@@ -0,0 +1,314 @@
+/********************************************************************************/
+// capture.c
+//	DIO transition capture to a memory-mapped file, and VCD/CSV decoder
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gpiolib.h"
+#include "gpio-event.h"
+#include "gpio-ring.h"
+#include "capture.h"
+
+struct capture {
+	int fd;
+	size_t maplen;
+	struct capture_header *hdr;
+	struct capture_rec *rec;
+	uint32_t max;
+	uint32_t n;
+	uint64_t start;
+	struct gpio_event_loop *loop;
+	int index[GPIO_MAX_PINS];	// gpio -> header pin index
+	uint32_t seq[CAPTURE_MAX_PINS];	// event loop's edge number per index
+};
+
+// Runs for every transition; stores straight into the mapping.  ns comes
+// from the event loop (the kernel's edge time on a character device pin),
+// so recording makes no system calls of its own.
+static void capture_edge(int gpio, int value, uint64_t ns, uint32_t seq,
+  void *arg)
+{
+	struct capture *cap = arg;
+	struct capture_rec *r;
+	int i = cap->index[gpio];
+	uint64_t t;
+
+	if(seq - cap->seq[i] > 1)
+		cap->hdr->lost += seq - cap->seq[i] - 1;
+	cap->seq[i] = seq;
+	if(cap->n == cap->max) {
+		cap->hdr->dropped++;
+		return;
+	}
+	// Queued edges can predate the start of the run
+	t = ns > cap->start ? ns - cap->start : 0;
+	r = &cap->rec[cap->n++];
+	r->ns_hi = t >> 32;
+	r->ns_lo = t;
+	r->pin = i;
+	r->value = value;
+	r->pad = 0;
+}
+
+struct capture *capture_open(const char *path, const int *pins, int npins,
+  unsigned max_records)
+{
+	struct capture *cap;
+	int i;
+
+	if(npins < 1 || npins > CAPTURE_MAX_PINS)
+		return NULL;
+	cap = calloc(1, sizeof(*cap));
+	if(!cap)
+		return NULL;
+	cap->max = max_records;
+	cap->maplen = sizeof(struct capture_header) +
+	  (size_t)max_records * sizeof(struct capture_rec);
+
+	cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(cap->fd < 0) {
+		perror(path);
+		goto err;
+	}
+	// Allocate the blocks now so recording never faults in new ones
+	if(posix_fallocate(cap->fd, 0, cap->maplen)) {
+		fprintf(stderr, "%s: can't reserve %lu bytes\n", path,
+		  (unsigned long)cap->maplen);
+		goto err;
+	}
+	cap->hdr = mmap(NULL, cap->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+	  cap->fd, 0);
+	if(cap->hdr == MAP_FAILED) {
+		perror("mmap");
+		cap->hdr = NULL;
+		goto err;
+	}
+	cap->rec = (struct capture_rec *)(cap->hdr + 1);
+
+	cap->loop = gpio_event_loop_new();
+	if(!cap->loop)
+		goto err;
+
+	memcpy(cap->hdr->magic, CAPTURE_MAGIC, sizeof(cap->hdr->magic));
+	cap->hdr->version = CAPTURE_VERSION;
+	cap->hdr->npins = npins;
+	for(i = 0; i < npins; i++) {
+		if(pins[i] < 0 || pins[i] >= GPIO_MAX_PINS)
+			goto err;
+		cap->hdr->pins[i] = pins[i];
+		cap->index[pins[i]] = i;
+		if(gpio_event_add(cap->loop, pins[i], 1, 1, capture_edge, cap))
+			goto err;
+		// The pin is the loop's now, and may not be readable otherwise
+		if(gpio_event_level(cap->loop, pins[i]) == 1)
+			cap->hdr->initial |= 1U << i;
+	}
+	return cap;
+
+err:
+	if(cap->loop)
+		gpio_event_loop_free(cap->loop);
+	if(cap->hdr)
+		munmap(cap->hdr, cap->maplen);
+	if(cap->fd >= 0)
+		close(cap->fd);
+	free(cap);
+	return NULL;
+}
+
+int capture_run(struct capture *cap, unsigned duration_ms)
+{
+	uint64_t end, now;
+	int left;
+
+	if(!cap->start) {
+		cap->start = gpio_ring_now();
+		cap->hdr->start_hi = cap->start >> 32;
+		cap->hdr->start_lo = cap->start;
+	}
+	end = gpio_ring_now() + (uint64_t)duration_ms * 1000000ULL;
+	while((now = gpio_ring_now()) < end) {
+		left = (end - now + 999999) / 1000000;
+		if(gpio_event_wait(cap->loop, left) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int capture_close(struct capture *cap)
+{
+	off_t len;
+	int ret = 0;
+
+	gpio_event_loop_free(cap->loop);
+	cap->hdr->nrecords = cap->n;
+	if(cap->hdr->dropped)
+		fprintf(stderr, "capture: %u transitions dropped, file full\n",
+		  cap->hdr->dropped);
+	if(cap->hdr->lost)
+		fprintf(stderr, "capture: %u edges lost before they were recorded\n",
+		  cap->hdr->lost);
+	len = sizeof(struct capture_header) + (off_t)cap->n * sizeof(struct capture_rec);
+	if(msync(cap->hdr, cap->maplen, MS_SYNC))
+		ret = -1;
+	munmap(cap->hdr, cap->maplen);
+	if(ftruncate(cap->fd, len))
+		ret = -1;
+	close(cap->fd);
+	free(cap);
+	return ret;
+}
+
+/********************************************************************************/
+// Decoder
+/********************************************************************************/
+
+// VCD identifiers are printable characters starting at '!'
+static char vcd_id(int i)
+{
+	return '!' + i;
+}
+
+// Each pin's edges arrive in time order, but one wakeup drains the pins in
+// turn, so a pin stored later can carry earlier kernel timestamps.  The
+// records are put back in time order here rather than on the capture path.
+struct capture_order {
+	uint64_t t;
+	uint32_t i;			// record number, keeps the sort stable
+};
+
+static int order_cmp(const void *a, const void *b)
+{
+	const struct capture_order *x = a, *y = b;
+
+	if(x->t != y->t)
+		return x->t < y->t ? -1 : 1;
+	return x->i < y->i ? -1 : x->i > y->i;
+}
+
+// Returns the records' time order, or NULL on allocation failure
+static struct capture_order *capture_sort(const struct capture_rec *rec,
+  uint32_t n)
+{
+	struct capture_order *o;
+	uint32_t i;
+	int sorted = 1;
+
+	o = malloc((n ? n : 1) * sizeof(*o));
+	if(!o)
+		return NULL;
+	for(i = 0; i < n; i++) {
+		o[i].t = (uint64_t)rec[i].ns_hi << 32 | rec[i].ns_lo;
+		o[i].i = i;
+		if(i && o[i].t < o[i - 1].t)
+			sorted = 0;
+	}
+	if(!sorted)
+		qsort(o, n, sizeof(*o), order_cmp);
+	return o;
+}
+
+int capture_decode(const char *path, FILE *out, int format)
+{
+	struct capture_header *hdr;
+	struct capture_rec *rec, *r;
+	struct capture_order *order;
+	struct stat st;
+	uint64_t t, last = UINT64_MAX;
+	uint32_t i, n, bad = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		return -1;
+	}
+	if((size_t)st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(hdr == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	if(memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) ||
+	  hdr->version != CAPTURE_VERSION || hdr->npins > CAPTURE_MAX_PINS) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		munmap(hdr, st.st_size);
+		return -1;
+	}
+	rec = (struct capture_rec *)(hdr + 1);
+	n = hdr->nrecords;
+	if(n > (st.st_size - sizeof(*hdr)) / sizeof(*rec)) {
+		n = (st.st_size - sizeof(*hdr)) / sizeof(*rec);
+		fprintf(stderr, "%s: truncated, %u of %u transitions present\n",
+		  path, n, hdr->nrecords);
+	}
+	order = capture_sort(rec, n);
+	if(!order) {
+		perror("malloc");
+		munmap(hdr, st.st_size);
+		return -1;
+	}
+
+	if(format == CAPTURE_CSV) {
+		fprintf(out, "time_ns,gpio,value\n");
+		for(i = 0; i < hdr->npins; i++)
+			fprintf(out, "0,%d,%u\n", hdr->pins[i], (hdr->initial >> i) & 1);
+		for(i = 0; i < n; i++) {
+			r = &rec[order[i].i];
+			// A corrupt record names no pin of this capture
+			if(r->pin >= hdr->npins) {
+				bad++;
+				continue;
+			}
+			fprintf(out, "%llu,%d,%u\n", (unsigned long long)order[i].t,
+			  hdr->pins[r->pin], r->value);
+		}
+	} else {
+		fprintf(out, "$timescale 1ns $end\n$scope module ts7680 $end\n");
+		for(i = 0; i < hdr->npins; i++)
+			fprintf(out, "$var wire 1 %c gpio%d $end\n", vcd_id(i), hdr->pins[i]);
+		fprintf(out, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+		for(i = 0; i < hdr->npins; i++)
+			fprintf(out, "%u%c\n", (hdr->initial >> i) & 1, vcd_id(i));
+		fprintf(out, "$end\n");
+		for(i = 0; i < n; i++) {
+			r = &rec[order[i].i];
+			if(r->pin >= hdr->npins) {
+				bad++;
+				continue;
+			}
+			t = order[i].t;
+			if(t != last)
+				fprintf(out, "#%llu\n", (unsigned long long)t);
+			last = t;
+			fprintf(out, "%u%c\n", r->value & 1, vcd_id(r->pin));
+		}
+	}
+
+	if(hdr->dropped)
+		fprintf(stderr, "%s: %u transitions were dropped\n", path, hdr->dropped);
+	if(hdr->lost)
+		fprintf(stderr, "%s: %u edges were lost before recording\n", path,
+		  hdr->lost);
+	if(bad)
+		fprintf(stderr, "%s: %u records with a bad pin index skipped\n",
+		  path, bad);
+	free(order);
+	munmap(hdr, st.st_size);
+	return bad ? -1 : 0;
+}
@@ -0,0 +1,59 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Logic analyzer style capture of DIO transitions into a memory-mapped
+// file.  The file is sized up front; recording stores into the mapping and
+// does no allocation or I/O beyond reading the event itself.  Transitions
+// carry the kernel's timestamp where the pin has a character device edge
+// request, the event loop's wakeup time otherwise.  Records are stored in
+// arrival order, which can interleave pins out of time order; the decoder
+// sorts them.
+
+#define CAPTURE_MAGIC		"TSCAPT1"
+#define CAPTURE_VERSION		1
+#define CAPTURE_MAX_PINS	32
+
+#define CAPTURE_VCD		0
+#define CAPTURE_CSV		1
+
+struct capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t npins;
+	int32_t pins[CAPTURE_MAX_PINS];
+	uint32_t initial;		// level of each pin at the start, bit per index
+	uint32_t dropped;		// transitions lost to a full file
+	uint32_t nrecords;
+	uint32_t start_hi;		// CLOCK_MONOTONIC ns at the start
+	uint32_t start_lo;
+	uint32_t lost;			// edges that never reached the capture:
+					// merged by sysfs or overflowed the
+					// kernel's queue
+	uint32_t reserved[2];
+};
+
+// 12 bytes, 32-bit aligned so the ARM9 never takes unaligned accesses
+struct capture_rec {
+	uint32_t ns_hi;			// ns since the start
+	uint32_t ns_lo;
+	uint16_t pin;			// index into header pins[]
+	uint8_t value;
+	uint8_t pad;
+};
+
+struct capture;
+
+struct capture *capture_open(const char *path, const int *pins, int npins,
+  unsigned max_records);
+// Records for duration_ms in the calling thread
+int capture_run(struct capture *cap, unsigned duration_ms);
+// Writes the final header, trims the file and frees cap
+int capture_close(struct capture *cap);
+// Prints every record that names one of the capture's pins; -1 if the
+// file isn't a capture or had records that don't
+int capture_decode(const char *path, FILE *out, int format);
+
+#endif //_CAPTURE_H_
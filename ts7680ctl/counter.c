@@ -0,0 +1,161 @@
+/********************************************************************************/
+// counter.c
+//	Pulse counting and frequency/period measurement on DIO inputs
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gpio-event.h"
+#include "gpio-ring.h"
+#include "counter.h"
+
+struct counter_pin {
+	struct pulse_counter *pc;
+	int gpio;
+	uint32_t seq;		// odd while the event thread is updating
+	uint32_t line_seq;	// event loop's edge number at the last callback
+	uint64_t count;
+	uint64_t events;
+	uint64_t last_ns;
+	uint64_t period_ns;
+	double freq_hz;
+	uint64_t win_start;
+	uint64_t win_count;
+};
+
+struct pulse_counter {
+	struct gpio_event_loop *loop;
+	uint64_t window_ns;
+	int npins;
+	struct counter_pin pins[COUNTER_MAX_PINS];
+};
+
+struct pulse_counter *counter_new(unsigned window_ms)
+{
+	struct pulse_counter *pc;
+
+	pc = calloc(1, sizeof(*pc));
+	if(!pc)
+		return NULL;
+	pc->loop = gpio_event_loop_new();
+	if(!pc->loop) {
+		free(pc);
+		return NULL;
+	}
+	pc->window_ns = (uint64_t)(window_ms ? window_ms : 1000) * 1000000ULL;
+	return pc;
+}
+
+void counter_free(struct pulse_counter *pc)
+{
+	if(!pc)
+		return;
+	gpio_event_loop_free(pc->loop);
+	free(pc);
+}
+
+// Runs on the event thread, the only writer of the pin's state
+static void counter_edge(int gpio, int value, uint64_t now, uint32_t seq,
+  void *arg)
+{
+	struct counter_pin *p = arg;
+	uint32_t edges = seq - p->line_seq;
+	uint64_t dt;
+
+	(void)gpio;
+	(void)value;
+
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	// Edges lost on the way here still count, and still took their time
+	if(!edges)
+		edges = 1;
+	p->line_seq = seq;
+	p->count += edges;
+	p->events++;
+	if(p->last_ns) {
+		// Smooth the interval over 1/8 so a single late edge doesn't
+		// swing the period estimate
+		dt = (now - p->last_ns) / edges;
+		p->period_ns = p->period_ns ? p->period_ns - p->period_ns / 8 + dt / 8 : dt;
+	}
+	p->last_ns = now;
+
+	if(!p->win_start) {
+		p->win_start = now;
+		p->win_count = p->count;
+	} else if(now - p->win_start >= p->pc->window_ns) {
+		p->freq_hz = (p->count - p->win_count) * 1e9 / (double)(now - p->win_start);
+		p->win_start = now;
+		p->win_count = p->count;
+	}
+
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+}
+
+int counter_add(struct pulse_counter *pc, int gpio, int rising, int falling)
+{
+	struct counter_pin *p;
+
+	if(pc->npins == COUNTER_MAX_PINS) {
+		fprintf(stderr, "Too many counter pins\n");
+		return -1;
+	}
+	p = &pc->pins[pc->npins];
+	memset(p, 0, sizeof(*p));
+	p->pc = pc;
+	p->gpio = gpio;
+	if(gpio_event_add(pc->loop, gpio, rising, falling, counter_edge, p))
+		return -1;
+	pc->npins++;
+	return 0;
+}
+
+int counter_start(struct pulse_counter *pc)
+{
+	return gpio_event_start(pc->loop);
+}
+
+void counter_stop(struct pulse_counter *pc)
+{
+	gpio_event_stop(pc->loop);
+}
+
+int counter_read(struct pulse_counter *pc, int gpio, struct counter_reading *r)
+{
+	struct counter_pin *p = NULL;
+	uint64_t now;
+	uint32_t seq;
+	int i;
+
+	for(i = 0; i < pc->npins; i++) {
+		if(pc->pins[i].gpio == gpio)
+			p = &pc->pins[i];
+	}
+	if(!p)
+		return -1;
+
+	do {
+		seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+		r->count = p->count;
+		r->events = p->events;
+		r->freq_hz = p->freq_hz;
+		r->period_ns = p->period_ns;
+		r->last_edge_ns = p->last_ns;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((seq & 1) || seq != __atomic_load_n(&p->seq, __ATOMIC_RELAXED));
+
+	// No edge for two windows: the input has stopped
+	now = gpio_ring_now();
+	if(!r->last_edge_ns || now - r->last_edge_ns > 2 * pc->window_ns) {
+		r->freq_hz = 0;
+		r->period_ns = 0;
+	}
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _COUNTER_H_
+#define _COUNTER_H_
+
+#include <stdint.h>
+
+// Pulse counting and frequency/period measurement on DIO inputs.  Edges
+// come from a gpio_event_loop running on its own thread, timestamped by the
+// kernel where the pin has a character device edge request; the per-pin
+// state is published with a sequence lock so readers never block the
+// counter.
+
+#define COUNTER_MAX_PINS	32
+
+struct counter_reading {
+	uint64_t count;			// edges since counter_add(), with the
+					// ones the event loop knows it lost
+	uint64_t events;		// edges that arrived as events
+	double freq_hz;			// over the last complete window
+	uint64_t period_ns;		// smoothed time between edges
+	uint64_t last_edge_ns;		// CLOCK_MONOTONIC, 0 if none yet
+};
+
+struct pulse_counter;
+
+struct pulse_counter *counter_new(unsigned window_ms);
+void counter_free(struct pulse_counter *pc);
+// Counts the selected edges of gpio, through a character device edge
+// request where there is one, gpio_setedge() otherwise
+int counter_add(struct pulse_counter *pc, int gpio, int rising, int falling);
+int counter_start(struct pulse_counter *pc);
+void counter_stop(struct pulse_counter *pc);
+int counter_read(struct pulse_counter *pc, int gpio, struct counter_reading *r);
+
+#endif //_COUNTER_H_
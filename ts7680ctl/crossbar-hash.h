@@ -0,0 +1,49 @@
+// Generated by mkcbarhash from crossbar-ts7680.h, do not edit
+#ifndef _CROSSBAR_HASH_H_
+#define _CROSSBAR_HASH_H_
+
+#define CBAR_HASH_SLOTS	256
+
+static const uint32_t cbar_input_seed = 0x8;
+// Index + 1 into ts7680_inputs[], 0 for an empty slot
+static const uint8_t cbar_input_slot[CBAR_HASH_SLOTS] = {
+	0, 0, 7, 0, 0, 0, 0, 2, 0, 0, 33, 0, 32, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 22, 0, 23, 34, 0, 0, 0, 0, 0, 30,
+	0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0, 0, 21, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 31, 0, 15,
+	0, 0, 0, 9, 0, 0, 0, 0, 0, 0, 0, 28, 0, 0, 3, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 27, 0, 0, 0, 18, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 19, 1, 0, 0, 0, 0, 0, 0, 0, 0, 20, 0, 0,
+	0, 0, 24, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 13,
+	0, 0, 0, 0, 0, 8, 29, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	10, 0, 16, 0, 25, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 0,
+	0, 0, 0, 35, 0, 26, 0, 0, 0, 0, 0, 17, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 14, 0, 0, 0,
+};
+
+static const uint32_t cbar_output_seed = 0x56;
+// Index + 1 into ts7680_outputs[], 0 for an empty slot
+static const uint8_t cbar_output_slot[CBAR_HASH_SLOTS] = {
+	27, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 37, 29,
+	0, 0, 0, 0, 23, 0, 0, 43, 22, 0, 9, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 40,
+	0, 0, 0, 0, 0, 49, 0, 0, 0, 0, 0, 0, 0, 41, 48, 0,
+	5, 0, 0, 0, 0, 0, 0, 20, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 18, 0, 0, 10, 33, 0, 0, 0, 46, 0,
+	14, 11, 0, 0, 0, 0, 0, 4, 32, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 36, 30, 0, 0, 0,
+	1, 0, 0, 0, 44, 6, 0, 15, 0, 0, 0, 0, 0, 0, 21, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 39, 0, 0, 0,
+	0, 38, 7, 25, 0, 0, 0, 0, 0, 0, 42, 0, 13, 47, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 28, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 24, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	50, 26, 0, 0, 0, 19, 0, 0, 35, 0, 17, 0, 0, 34, 3, 0,
+	0, 45, 0, 31, 0, 0, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0,
+};
+
+#endif //_CROSSBAR_HASH_H_
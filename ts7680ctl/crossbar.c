@@ -0,0 +1,197 @@
+/********************************************************************************/
+// crossbar.c
+//	FPGA crossbar routing for the TS-7680
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fpga.h"
+#include "crossbar.h"
+#include "crossbar-ts7680.h"
+#include "crossbar-hash.h"
+
+#define NPINS(t)	((int)(sizeof(t) / sizeof(t[0])) - 1)
+
+// One hash and one strcmp to confirm, instead of scanning the table
+static int lookup(const char *name, uint32_t seed, const uint8_t *slot,
+  struct cbarpin *pins)
+{
+	int i = slot[cbar_hash(name, seed) % CBAR_HASH_SLOTS];
+
+	if(!i || strcmp(pins[i - 1].name, name))
+		return -1;
+	return pins[i - 1].addr;
+}
+
+int cbar_find_out(const char *name)
+{
+	return lookup(name, cbar_input_seed, cbar_input_slot, ts7680_inputs);
+}
+
+int cbar_find_in(const char *name)
+{
+	return lookup(name, cbar_output_seed, cbar_output_slot, ts7680_outputs);
+}
+
+const char *cbar_out_name(int reg)
+{
+	int i;
+
+	for(i = 0; i < NPINS(ts7680_inputs); i++) {
+		if(ts7680_inputs[i].addr == reg)
+			return ts7680_inputs[i].name;
+	}
+	return NULL;
+}
+
+const char *cbar_in_name(int src)
+{
+	int i;
+
+	for(i = 0; i < NPINS(ts7680_outputs); i++) {
+		if(ts7680_outputs[i].addr == src)
+			return ts7680_outputs[i].name;
+	}
+	return NULL;
+}
+
+int cbar_read(struct fpga_dev *dev, uint8_t regs[CBAR_REGS])
+{
+	if(fpga_peekN(dev, 0, regs, CBAR_REGS)) {
+		perror("Couldn't read the crossbar");
+		return -1;
+	}
+	return 0;
+}
+
+int cbar_print(struct fpga_dev *dev, FILE *out)
+{
+	uint8_t regs[CBAR_REGS];
+	const char *in;
+	int i, src;
+
+	if(cbar_read(dev, regs))
+		return -1;
+	for(i = 0; i < NPINS(ts7680_inputs); i++) {
+		src = regs[ts7680_inputs[i].addr] >> CBAR_SHIFT;
+		in = cbar_in_name(src);
+		if(in)
+			fprintf(out, "%s=%s\n", ts7680_inputs[i].name, in);
+		else
+			fprintf(out, "%s=0x%x\n", ts7680_inputs[i].name, src);
+	}
+	return 0;
+}
+
+int cbar_parse(const char *spec, struct cbar_route *r)
+{
+	char out[32];
+	const char *eq;
+	int reg, src;
+
+	eq = strchr(spec, '=');
+	if(!eq || eq == spec || eq - spec >= (int)sizeof(out)) {
+		fprintf(stderr, "Expected OUT=IN, got '%s'\n", spec);
+		return -1;
+	}
+	memcpy(out, spec, eq - spec);
+	out[eq - spec] = 0;
+
+	reg = cbar_find_out(out);
+	if(reg < 0) {
+		fprintf(stderr, "Unknown crossbar output '%s'\n", out);
+		return -1;
+	}
+	src = cbar_find_in(eq + 1);
+	if(src < 0) {
+		fprintf(stderr, "Unknown crossbar input '%s'\n", eq + 1);
+		return -1;
+	}
+	r->reg = reg;
+	r->src = src;
+	return 0;
+}
+
+int cbar_load_file(const char *path, struct cbar_route *r, int max)
+{
+	FILE *f;
+	char line[80], *p, *end;
+	int n = 0, lineno = 0, err = 0;
+
+	f = fopen(path, "r");
+	if(!f) {
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		lineno++;
+		p = strchr(line, '#');
+		if(p)
+			*p = 0;
+		for(p = line; isspace((unsigned char)*p); p++)
+			;
+		for(end = p + strlen(p); end > p && isspace((unsigned char)end[-1]); end--)
+			;
+		*end = 0;
+		if(!*p)
+			continue;
+		if(n == max) {
+			fprintf(stderr, "%s:%d: too many routes\n", path, lineno);
+			err = 1;
+			break;
+		}
+		if(cbar_parse(p, &r[n])) {
+			fprintf(stderr, "%s:%d: bad route\n", path, lineno);
+			err = 1;
+			continue;
+		}
+		n++;
+	}
+	fclose(f);
+	return err ? -1 : n;
+}
+
+int cbar_write_diff(struct fpga_dev *dev, const uint8_t cur[CBAR_REGS],
+  const uint8_t want[CBAR_REGS])
+{
+	int i, first, written = 0;
+
+	for(i = 0; i < CBAR_REGS; i++) {
+		if(want[i] == cur[i])
+			continue;
+		for(first = i; i < CBAR_REGS && want[i] != cur[i]; i++)
+			;
+		if(fpga_pokeN(dev, first, &want[first], i - first)) {
+			perror("Couldn't write the crossbar");
+			return -1;
+		}
+		written += i - first;
+	}
+	return written;
+}
+
+int cbar_apply(struct fpga_dev *dev, const struct cbar_route *r, int n)
+{
+	uint8_t regs[CBAR_REGS], want[CBAR_REGS];
+	int i;
+
+	if(cbar_read(dev, regs))
+		return -1;
+	memcpy(want, regs, sizeof(want));
+	// Later routes for the same output win.  Only the selector bits
+	// change; the low bits keep whatever the pad is doing.
+	for(i = 0; i < n; i++) {
+		if(r[i].reg >= CBAR_REGS)
+			return -1;
+		want[r[i].reg] = (r[i].src << CBAR_SHIFT) |
+		  (regs[r[i].reg] & ((1 << CBAR_SHIFT) - 1));
+	}
+
+	return cbar_write_diff(dev, regs, want);
+}
@@ -0,0 +1,56 @@
+#ifndef _CROSSBAR_H_
+#define _CROSSBAR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// FPGA crossbar routing.  Every entry of ts7680_inputs[] is a register
+// (an FPGA pad or peripheral input, "OUT" below) whose bits 7:2 select
+// which ts7680_outputs[] signal ("IN") drives it.  Routes are written as
+// OUT=IN, e.g. DC_TXD=UART0_TXD.
+
+// Registers 0 to the highest crossbar address, read in one burst
+#define CBAR_REGS	90
+#define CBAR_SHIFT	2
+
+struct fpga_dev;
+
+struct cbar_route {
+	uint8_t reg;		// register address of OUT
+	uint8_t src;		// selector value of IN
+};
+
+// Name lookups through the generated perfect hash; -1 if unknown
+int cbar_find_out(const char *name);
+int cbar_find_in(const char *name);
+const char *cbar_out_name(int reg);
+const char *cbar_in_name(int src);
+
+int cbar_read(struct fpga_dev *dev, uint8_t regs[CBAR_REGS]);
+// Prints every route as OUT=IN
+int cbar_print(struct fpga_dev *dev, FILE *out);
+// Parses "OUT=IN"
+int cbar_parse(const char *spec, struct cbar_route *r);
+// Reads OUT=IN lines (# comments) into r[]; count or -1
+int cbar_load_file(const char *path, struct cbar_route *r, int max);
+// Writes each run of registers where want differs from cur as one burst;
+// returns the number of registers written or -1
+int cbar_write_diff(struct fpga_dev *dev, const uint8_t cur[CBAR_REGS],
+  const uint8_t want[CBAR_REGS]);
+// Reads the current mapping once and writes only the registers that
+// change, consecutive ones as one burst.  Returns registers written or -1.
+int cbar_apply(struct fpga_dev *dev, const struct cbar_route *r, int n);
+
+// Hash used by the generated tables in crossbar-hash.h (FNV-1a)
+static inline uint32_t cbar_hash(const char *s, uint32_t seed)
+{
+	uint32_t h = 2166136261U ^ seed;
+
+	while(*s) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+#endif //_CROSSBAR_H_
@@ -0,0 +1,204 @@
+/********************************************************************************/
+// fpga-cache.c
+//	Write-back register cache for the TS-7680 FPGA
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fpga.h"
+#include "fpga-cache.h"
+
+#define REG_VALID	0x1
+#define REG_DIRTY	0x2
+#define REG_VOLATILE	0x4
+
+// A clean gap this short is cheaper to rewrite than to pay the slave and
+// address bytes of another transaction
+#define FLUSH_MAX_GAP	3
+
+// Registers whose value can change without us writing them
+static const struct {
+	uint8_t first;
+	uint8_t last;
+} fpga_volatile_regs[] = {
+	{ 0x00, 0x0d },		// FPGA_22..FPGA_35 pads, bit 0 reads the pin
+};
+
+struct fpga_cache {
+	struct fpga_dev *dev;
+	uint8_t val[FPGA_CACHE_REGS];
+	uint8_t flags[FPGA_CACHE_REGS];
+	struct fpga_cache_stats st;
+};
+
+struct fpga_cache *fpga_cache_new(struct fpga_dev *dev)
+{
+	struct fpga_cache *c;
+	unsigned i;
+
+	c = calloc(1, sizeof(*c));
+	if(!c)
+		return NULL;
+	c->dev = dev;
+	for(i = 0; i < sizeof(fpga_volatile_regs) / sizeof(fpga_volatile_regs[0]); i++)
+		fpga_cache_set_volatile(c, fpga_volatile_regs[i].first,
+		  fpga_volatile_regs[i].last - fpga_volatile_regs[i].first + 1);
+	return c;
+}
+
+void fpga_cache_free(struct fpga_cache *c)
+{
+	if(!c)
+		return;
+	fpga_cache_flush(c);
+	free(c);
+}
+
+int fpga_cache_set_volatile(struct fpga_cache *c, uint16_t addr, int len)
+{
+	int i, ret = 0;
+
+	// Writes still held for these registers go out first, in order with
+	// the rest; from here on they would bypass the cache
+	for(i = 0; i < len && addr + i < FPGA_CACHE_REGS; i++) {
+		if(c->flags[addr + i] & REG_DIRTY) {
+			ret = fpga_cache_flush(c);
+			break;
+		}
+	}
+	for(; len > 0 && addr < FPGA_CACHE_REGS; addr++, len--) {
+		c->flags[addr] |= REG_VOLATILE;
+		c->flags[addr] &= ~REG_VALID;
+	}
+	return ret;
+}
+
+static int cacheable(struct fpga_cache *c, uint16_t addr)
+{
+	return addr < FPGA_CACHE_REGS && !(c->flags[addr] & REG_VOLATILE);
+}
+
+uint8_t fpga_cache_peek(struct fpga_cache *c, uint16_t addr)
+{
+	uint8_t v;
+
+	if(!cacheable(c, addr)) {
+		c->st.bypass++;
+		c->st.transactions++;
+		c->st.bytes_read++;
+		return fpga_peek8(c->dev, addr);
+	}
+	if(c->flags[addr] & REG_VALID) {
+		c->st.hits++;
+		return c->val[addr];
+	}
+	c->st.misses++;
+	c->st.transactions++;
+	c->st.bytes_read++;
+	if(fpga_peekN(c->dev, addr, &v, 1))
+		return 0;
+	c->val[addr] = v;
+	c->flags[addr] |= REG_VALID;
+	return v;
+}
+
+void fpga_cache_poke(struct fpga_cache *c, uint16_t addr, uint8_t value)
+{
+	if(!cacheable(c, addr)) {
+		c->st.bypass++;
+		c->st.transactions++;
+		c->st.bytes_written++;
+		fpga_poke8(c->dev, addr, value);
+		return;
+	}
+	if((c->flags[addr] & REG_VALID) && c->val[addr] == value) {
+		c->st.coalesced++;
+		return;
+	}
+	c->val[addr] = value;
+	c->flags[addr] |= REG_VALID | REG_DIRTY;
+}
+
+// Whether the gap [start, end) can be rewritten with values we know
+static int gap_known(struct fpga_cache *c, int start, int end)
+{
+	for(; start < end; start++) {
+		if((c->flags[start] & (REG_VALID | REG_VOLATILE)) != REG_VALID)
+			return 0;
+	}
+	return 1;
+}
+
+int fpga_cache_flush(struct fpga_cache *c)
+{
+	int addr = 0, first, last, next, ret = 0;
+
+	while(addr < FPGA_CACHE_REGS) {
+		if(!(c->flags[addr] & REG_DIRTY)) {
+			addr++;
+			continue;
+		}
+
+		// Extend the run over dirty registers and short known gaps
+		first = last = addr;
+		for(next = addr + 1; next < FPGA_CACHE_REGS; next++) {
+			if(!(c->flags[next] & REG_DIRTY))
+				continue;
+			if(next - last - 1 > FLUSH_MAX_GAP || !gap_known(c, last + 1, next))
+				break;
+			last = next;
+		}
+		if(last - first + 1 > FPGA_MAX_BURST)
+			last = first + FPGA_MAX_BURST - 1;
+
+		c->st.transactions++;
+		c->st.bytes_written += last - first + 1;
+		if(fpga_pokeN(c->dev, first, &c->val[first], last - first + 1)) {
+			ret = -1;
+		} else {
+			for(addr = first; addr <= last; addr++)
+				c->flags[addr] &= ~REG_DIRTY;
+		}
+		addr = last + 1;
+	}
+	return ret;
+}
+
+int fpga_cache_load(struct fpga_cache *c, uint16_t addr, int len)
+{
+	uint8_t buf[FPGA_MAX_BURST];
+	int i;
+
+	if(len <= 0 || len > FPGA_MAX_BURST)
+		return -1;
+	c->st.transactions++;
+	c->st.bytes_read += len;
+	if(fpga_peekN(c->dev, addr, buf, len))
+		return -1;
+	// Dirty values are newer than what the FPGA holds
+	for(i = 0; i < len; i++) {
+		if(!cacheable(c, addr + i) || (c->flags[addr + i] & REG_DIRTY))
+			continue;
+		c->val[addr + i] = buf[i];
+		c->flags[addr + i] |= REG_VALID;
+	}
+	return 0;
+}
+
+void fpga_cache_invalidate(struct fpga_cache *c)
+{
+	int i;
+
+	for(i = 0; i < FPGA_CACHE_REGS; i++)
+		c->flags[i] &= REG_VOLATILE;
+}
+
+void fpga_cache_get_stats(struct fpga_cache *c, struct fpga_cache_stats *st)
+{
+	*st = c->st;
+}
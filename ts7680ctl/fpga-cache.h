@@ -0,0 +1,45 @@
+#ifndef _FPGA_CACHE_H_
+#define _FPGA_CACHE_H_
+
+#include <stdint.h>
+
+// Optional write-back cache over the 0x00-0x7F FPGA register space.  Reads
+// of registers already known are served from memory; writes only mark the
+// register dirty until fpga_cache_flush() sends them as the fewest
+// contiguous bursts.  Registers listed as volatile, and anything above
+// 0x7F, always go straight to the bus.
+
+#define FPGA_CACHE_REGS		0x80
+
+struct fpga_cache_stats {
+	unsigned long hits;		// reads served from memory
+	unsigned long misses;		// reads that went to the bus
+	unsigned long bypass;		// volatile or out of range accesses
+	unsigned long coalesced;	// writes that changed nothing
+	unsigned long transactions;	// bus transactions issued
+	unsigned long bytes_read;	// register bytes moved, not counting
+	unsigned long bytes_written;	// the two address bytes
+};
+
+struct fpga_cache;
+struct fpga_dev;
+
+struct fpga_cache *fpga_cache_new(struct fpga_dev *dev);
+// Flushes anything dirty first
+void fpga_cache_free(struct fpga_cache *c);
+uint8_t fpga_cache_peek(struct fpga_cache *c, uint16_t addr);
+// Writes to volatile registers are sent at once and so may overtake
+// earlier dirty writes; flush first where the order matters
+void fpga_cache_poke(struct fpga_cache *c, uint16_t addr, uint8_t value);
+int fpga_cache_flush(struct fpga_cache *c);
+// Fill [addr, addr + len) with one burst read
+int fpga_cache_load(struct fpga_cache *c, uint16_t addr, int len);
+// Forget cached values (dirty ones are lost, flush first)
+void fpga_cache_invalidate(struct fpga_cache *c);
+// Mark more registers as volatile on top of the built-in table.  Flushes
+// first if any of them has a write pending; -1 if that flush failed, in
+// which case the write is retried by the next fpga_cache_flush().
+int fpga_cache_set_volatile(struct fpga_cache *c, uint16_t addr, int len);
+void fpga_cache_get_stats(struct fpga_cache *c, struct fpga_cache_stats *st);
+
+#endif //_FPGA_CACHE_H_
@@ -0,0 +1,157 @@
+/********************************************************************************/
+// fpga-config.c
+//	Save and restore FPGA crossbar/DAC configuration images
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fpga.h"
+#include "crossbar.h"
+#include "fpga-config.h"
+
+#define SEL_MASK	((uint8_t)~((1 << CBAR_SHIFT) - 1))
+
+static uint32_t crc32(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t crc = 0xffffffff;
+	int k;
+
+	while(len--) {
+		crc ^= *p++;
+		for(k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+// Bits of each register that the image restores
+static void restore_mask(uint8_t mask[CBAR_REGS])
+{
+	int i;
+
+	memset(mask, 0, CBAR_REGS);
+	for(i = 0; i < CBAR_REGS; i++) {
+		if(cbar_out_name(i))
+			mask[i] = SEL_MASK;
+	}
+	// DAC pairs: high nibble, then low byte
+	for(i = FPGA_DAC_BASE; i < FPGA_DAC_BASE + FPGA_DAC_CHANNELS * 2; i += 2) {
+		mask[i] = 0x0f;
+		mask[i + 1] = 0xff;
+	}
+}
+
+// A DAC channel's pair is only ever written whole and in order, as dac()
+// does, so the restore goes through dac_update() rather than the byte-wise
+// crossbar diff.  Returns the number of registers written, or -1.
+static int restore_dacs(struct fpga_dev *dev, const uint8_t cur[CBAR_REGS],
+  const uint8_t want[CBAR_REGS])
+{
+	uint16_t values[FPGA_DAC_CHANNELS];
+	unsigned mask = 0;
+	int ch, r, n = 0;
+
+	for(ch = 0; ch < FPGA_DAC_CHANNELS; ch++) {
+		r = FPGA_DAC_BASE + ch * 2;
+		values[ch] = (want[r] & 0x0f) << 8 | want[r + 1];
+		if(((cur[r] ^ want[r]) & 0x0f) || cur[r + 1] != want[r + 1]) {
+			mask |= 1U << ch;
+			n += 2;
+		}
+	}
+	if(mask && dac_update(dev, mask, values))
+		return -1;
+	return n;
+}
+
+int fpga_config_save(struct fpga_dev *dev, const char *path)
+{
+	struct fpga_config_image img;
+	FILE *f;
+
+	memset(&img, 0, sizeof(img));
+	memcpy(img.magic, FPGA_CONFIG_MAGIC, sizeof(img.magic));
+	img.version = FPGA_CONFIG_VERSION;
+	img.nregs = CBAR_REGS;
+	if(cbar_read(dev, img.regs))
+		return -1;
+	img.crc = crc32(&img, offsetof(struct fpga_config_image, crc));
+
+	f = fopen(path, "wb");
+	if(!f) {
+		perror(path);
+		return -1;
+	}
+	if(fwrite(&img, sizeof(img), 1, f) != 1) {
+		perror(path);
+		fclose(f);
+		return -1;
+	}
+	if(fclose(f)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+int fpga_config_load(struct fpga_dev *dev, const char *path)
+{
+	struct fpga_config_image img;
+	uint8_t cur[CBAR_REGS], want[CBAR_REGS], mask[CBAR_REGS];
+	uint8_t cbar[CBAR_REGS];
+	FILE *f;
+	int i, n, dacs;
+
+	f = fopen(path, "rb");
+	if(!f) {
+		perror(path);
+		return -1;
+	}
+	n = fread(&img, sizeof(img), 1, f);
+	fclose(f);
+	if(n != 1 || memcmp(img.magic, FPGA_CONFIG_MAGIC, sizeof(img.magic)) ||
+	  img.version != FPGA_CONFIG_VERSION || img.nregs != CBAR_REGS) {
+		fprintf(stderr, "%s: not a configuration image\n", path);
+		return -1;
+	}
+	if(img.crc != crc32(&img, offsetof(struct fpga_config_image, crc))) {
+		fprintf(stderr, "%s: checksum mismatch\n", path);
+		return -1;
+	}
+
+	restore_mask(mask);
+	if(cbar_read(dev, cur))
+		return -1;
+	for(i = 0; i < CBAR_REGS; i++)
+		want[i] = (cur[i] & ~mask[i]) | (img.regs[i] & mask[i]);
+	// The crossbar diff leaves the DAC registers alone
+	memcpy(cbar, want, sizeof(cbar));
+	memcpy(&cbar[FPGA_DAC_BASE], &cur[FPGA_DAC_BASE], FPGA_DAC_CHANNELS * 2);
+	n = cbar_write_diff(dev, cur, cbar);
+	if(n < 0)
+		return n;
+	dacs = restore_dacs(dev, cur, want);
+	if(dacs < 0)
+		return -1;
+	n += dacs;
+	if(!n)
+		return 0;
+
+	if(cbar_read(dev, cur))
+		return -1;
+	for(i = 0; i < CBAR_REGS; i++) {
+		if((cur[i] ^ want[i]) & mask[i]) {
+			fprintf(stderr, "Register 0x%02x reads 0x%02x, wrote 0x%02x\n",
+			  i, cur[i], want[i]);
+			return -1;
+		}
+	}
+	return n;
+}
@@ -0,0 +1,33 @@
+#ifndef _FPGA_CONFIG_H_
+#define _FPGA_CONFIG_H_
+
+#include <stdint.h>
+
+#include "crossbar.h"
+
+// Binary snapshot of the FPGA crossbar and DAC registers for restoring a
+// board's setup in one go at boot.  The image is the whole 0..CBAR_REGS
+// register block as read in one burst; only the crossbar selector bits
+// and the DAC registers are restored from it.
+
+#define FPGA_CONFIG_MAGIC	"TSCF"
+#define FPGA_CONFIG_VERSION	1
+
+struct fpga_config_image {
+	char magic[4];
+	uint16_t version;
+	uint16_t nregs;
+	uint8_t regs[CBAR_REGS];
+	uint8_t pad[2];
+	uint32_t crc;			// CRC-32 of everything above
+};
+
+struct fpga_dev;
+
+int fpga_config_save(struct fpga_dev *dev, const char *path);
+// Writes only the crossbar registers that differ, and rewrites each DAC
+// channel whose pair differs as a whole through dac_update(), then reads
+// the block back once to verify.  Returns registers written or -1.
+int fpga_config_load(struct fpga_dev *dev, const char *path);
+
+#endif //_FPGA_CONFIG_H_
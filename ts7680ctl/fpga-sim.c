@@ -0,0 +1,150 @@
+/********************************************************************************/
+// fpga-sim.c
+//	Simulated TS-7680 FPGA I2C slave
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "i2c-dev.h"
+#include "fpga.h"
+#include "fpga-sim.h"
+
+#define SIM_FD		0x7680
+#define SIM_REVISION	0x0B
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t sim_regs[0x10000];
+static uint16_t sim_ptr;
+static unsigned sim_latency;
+static struct fpga_sim_stats sim_st;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Hold the bus for the time the bytes would take to clock out.  Spin
+// rather than sleep, the delays are far below the scheduler's resolution.
+static void sim_wire(unsigned bytes)
+{
+	uint64_t end;
+
+	sim_st.wire_bytes += bytes;
+	if(!sim_latency)
+		return;
+	end = now_ns() + (uint64_t)bytes * sim_latency;
+	while(now_ns() < end)
+		;
+}
+
+static int sim_open(const char *path, int flags)
+{
+	(void)path;
+	(void)flags;
+	return SIM_FD;
+}
+
+static int sim_close(int fd)
+{
+	(void)fd;
+	return 0;
+}
+
+static void sim_msg(struct i2c_msg *m)
+{
+	uint8_t *buf = (uint8_t *)m->buf;
+	int i;
+
+	if(m->flags & I2C_M_RD) {
+		for(i = 0; i < m->len; i++)
+			buf[i] = sim_regs[sim_ptr++];
+		return;
+	}
+	for(i = 0; i < m->len; i++) {
+		if(i == 0)
+			sim_ptr = buf[0] << 8;
+		else if(i == 1)
+			sim_ptr |= buf[1];
+		else if(sim_ptr == FPGA_SIM_REVISION)
+			sim_ptr++;
+		else
+			sim_regs[sim_ptr++] = buf[i];
+	}
+}
+
+static int sim_ioctl(int fd, unsigned long req, void *arg)
+{
+	struct i2c_rdwr_ioctl_data *rdwr = arg;
+	int i;
+
+	if(fd != SIM_FD) {
+		errno = EBADF;
+		return -1;
+	}
+	if(req == I2C_SLAVE_FORCE || req == I2C_SLAVE)
+		return 0;
+	if(req != I2C_RDWR) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	pthread_mutex_lock(&sim_lock);
+	sim_st.transactions++;
+	for(i = 0; i < rdwr->nmsgs; i++) {
+		// Only the address byte goes out before a NAK
+		if(rdwr->msgs[i].addr != FPGA_I2C_ADDR) {
+			sim_wire(1);
+			sim_st.naks++;
+			pthread_mutex_unlock(&sim_lock);
+			errno = ENXIO;
+			return -1;
+		}
+		sim_wire(1 + rdwr->msgs[i].len);
+		sim_msg(&rdwr->msgs[i]);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return rdwr->nmsgs;
+}
+
+const struct fpga_i2c_ops fpga_sim_ops = {
+	.open = sim_open,
+	.close = sim_close,
+	.ioctl = sim_ioctl,
+};
+
+void fpga_sim_set_latency(unsigned ns_per_byte)
+{
+	sim_latency = ns_per_byte;
+}
+
+void fpga_sim_reset(void)
+{
+	pthread_mutex_lock(&sim_lock);
+	memset(sim_regs, 0, sizeof(sim_regs));
+	sim_regs[FPGA_SIM_REVISION] = SIM_REVISION;
+	sim_ptr = 0;
+	memset(&sim_st, 0, sizeof(sim_st));
+	pthread_mutex_unlock(&sim_lock);
+}
+
+uint8_t *fpga_sim_regs(void)
+{
+	return sim_regs;
+}
+
+void fpga_sim_get_stats(struct fpga_sim_stats *st)
+{
+	pthread_mutex_lock(&sim_lock);
+	*st = sim_st;
+	pthread_mutex_unlock(&sim_lock);
+}
@@ -0,0 +1,32 @@
+#ifndef _FPGA_SIM_H_
+#define _FPGA_SIM_H_
+
+#include <stdint.h>
+
+#include "fpga.h"
+
+// In-process TS-7680 FPGA I2C slave for benchmarks and tests.  Install
+// with fpga_set_i2c_ops(&fpga_sim_ops) and fpga_open() any path.  Only
+// address FPGA_I2C_ADDR acknowledges.  A write message loads the 16-bit
+// address pointer from its first two bytes and stores any further bytes;
+// a read message returns bytes from the pointer.  Both auto-increment.
+
+#define FPGA_SIM_REVISION	0x7F	// read-only register
+
+struct fpga_sim_stats {
+	unsigned long transactions;	// I2C_RDWR calls
+	unsigned long naks;
+	unsigned long wire_bytes;	// slave address + data bytes clocked
+};
+
+extern const struct fpga_i2c_ops fpga_sim_ops;
+
+// Time each byte takes on the wire; 0 for an infinitely fast bus.  At
+// 400 kHz a byte plus ACK is 9 clocks, about 22500 ns.
+void fpga_sim_set_latency(unsigned ns_per_byte);
+// Clear the registers and counters
+void fpga_sim_reset(void);
+uint8_t *fpga_sim_regs(void);
+void fpga_sim_get_stats(struct fpga_sim_stats *st);
+
+#endif //_FPGA_SIM_H_
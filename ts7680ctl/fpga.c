@@ -1,60 +1,276 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "i2c-dev.h"
+#include "fpga.h"
 
-int fpga_init(char *path, char adr)
+static int sys_open(const char *path, int flags)
+{
+        return open(path, flags);
+}
+
+static int sys_ioctl(int fd, unsigned long req, void *arg)
 {
-        static int fd = -1;
+        return ioctl(fd, req, arg);
+}
+
+static const struct fpga_i2c_ops fpga_sys_ops = {
+        .open = sys_open,
+        .close = close,
+        .ioctl = sys_ioctl,
+};
 
-        if(fd != -1)
-                return fd;
+static const struct fpga_i2c_ops *i2c_ops = &fpga_sys_ops;
 
-        if(path == NULL) {
-                // Will always be I2C0 on the 7680
-                fd = open("/dev/i2c-0", O_RDWR);
+void fpga_set_i2c_ops(const struct fpga_i2c_ops *ops)
+{
+        i2c_ops = ops ? ops : &fpga_sys_ops;
+}
+
+struct fpga_dev {
+        int fd;
+        uint8_t adr;
+        const struct fpga_i2c_ops *ops;
+        pthread_mutex_t lock;           // guards st
+        struct fpga_stats st;
+};
+
+// One I2C_RDWR ioctl per transaction.  A read sends the 16-bit register
+// address and reads len bytes back joined by a repeated start, instead of
+// a STOP between two syscalls.  A write is the address followed by the
+// data.  The FPGA auto-increments the address after each byte, so either
+// covers len consecutive registers.
+static int fpga_xfer(const struct fpga_i2c_ops *ops, int fd, uint8_t adr,
+  uint16_t addr, uint8_t *rbuf, const uint8_t *wbuf, int len)
+{
+        struct i2c_rdwr_ioctl_data rdwr;
+        struct i2c_msg msgs[2];
+        uint8_t data[2 + FPGA_MAX_BURST];
+
+        if (len <= 0 || len > FPGA_MAX_BURST) {
+                errno = EINVAL;
+                return -1;
+        }
+        data[0] = ((addr >> 8) & 0xff);
+        data[1] = (addr & 0xff);
+
+        msgs[0].addr = adr;
+        msgs[0].flags = 0;
+        msgs[0].len = 2;
+        msgs[0].buf = (char *)data;
+        rdwr.msgs = msgs;
+        rdwr.nmsgs = 1;
+        if (wbuf) {
+                memcpy(data + 2, wbuf, len);
+                msgs[0].len = 2 + len;
         } else {
+                msgs[1].addr = adr;
+                msgs[1].flags = I2C_M_RD;
+                msgs[1].len = len;
+                msgs[1].buf = (char *)rbuf;
+                rdwr.nmsgs = 2;
+        }
+        return ops->ioctl(fd, I2C_RDWR, &rdwr) < 0 ? -1 : 0;
+}
+
+/********************************************************************************/
+// Device contexts
+/********************************************************************************/
+
+struct fpga_dev *fpga_open(const char *path, int adr)
+{
+        struct fpga_dev *dev;
 
-                fd = open(path, O_RDWR);
+        // Will always be I2C0 on the 7680
+        if (path == NULL)
+                path = "/dev/i2c-0";
+        if (!adr)
+                adr = FPGA_I2C_ADDR;
+
+        dev = calloc(1, sizeof(*dev));
+        if (!dev)
+                return NULL;
+        dev->adr = adr;
+        dev->ops = i2c_ops;
+        dev->fd = dev->ops->open(path, O_RDWR | O_CLOEXEC);
+        if (dev->fd < 0) {
+                perror(path);
+                free(dev);
+                return NULL;
+        }
+        // Plain read()/write() on fpga_fd() keep working for old callers
+        if (dev->ops->ioctl(dev->fd, I2C_SLAVE_FORCE, (void *)(long)adr) < 0) {
+                fprintf(stderr, "FPGA did not ACK 0x%02x\n", adr);
+                dev->ops->close(dev->fd);
+                free(dev);
+                return NULL;
         }
+        pthread_mutex_init(&dev->lock, NULL);
+        return dev;
+}
+
+void fpga_close(struct fpga_dev *dev)
+{
+        if (!dev)
+                return;
+        dev->ops->close(dev->fd);
+        pthread_mutex_destroy(&dev->lock);
+        free(dev);
+}
 
-        if(!adr) adr = 0x28;
+int fpga_fd(struct fpga_dev *dev)
+{
+        return dev->fd;
+}
 
-        if(fd != -1) {
-                if (ioctl(fd, I2C_SLAVE_FORCE, 0x28) < 0) {
-                        perror("FPGA did not ACK 0x28\n");
-                        return -1;
-                }
+static int dev_xfer(struct fpga_dev *dev, uint16_t addr, uint8_t *rbuf,
+  const uint8_t *wbuf, int len)
+{
+        int ret, err;
+
+        ret = fpga_xfer(dev->ops, dev->fd, dev->adr, addr, rbuf, wbuf, len);
+        err = errno;
+
+        pthread_mutex_lock(&dev->lock);
+        dev->st.transactions++;
+        if (ret) {
+                dev->st.errors++;
+                dev->st.last_error = err;
+        } else if (rbuf) {
+                dev->st.bytes_read += len;
+        } else {
+                dev->st.bytes_written += len;
         }
+        pthread_mutex_unlock(&dev->lock);
+        return ret;
+}
 
-        return fd;
+int fpga_peekN(struct fpga_dev *dev, uint16_t addr, uint8_t *buf, int len)
+{
+        return dev_xfer(dev, addr, buf, NULL, len);
 }
 
-void fpoke8(int twifd, uint16_t addr, uint8_t value)
+int fpga_pokeN(struct fpga_dev *dev, uint16_t addr, const uint8_t *buf, int len)
 {
-        uint8_t data[3];
-        data[0] = ((addr >> 8) & 0xff);
-        data[1] = (addr & 0xff);
-        data[2] = value;
-        if (write(twifd, data, 3) != 3) {
+        return dev_xfer(dev, addr, NULL, buf, len);
+}
+
+uint8_t fpga_peek8(struct fpga_dev *dev, uint16_t addr)
+{
+        uint8_t value = 0;
+
+        fpga_peekN(dev, addr, &value, 1);
+        return value;
+}
+
+int fpga_poke8(struct fpga_dev *dev, uint16_t addr, uint8_t value)
+{
+        return fpga_pokeN(dev, addr, &value, 1);
+}
+
+void fpga_get_stats(struct fpga_dev *dev, struct fpga_stats *st)
+{
+        pthread_mutex_lock(&dev->lock);
+        *st = dev->st;
+        pthread_mutex_unlock(&dev->lock);
+}
+
+/********************************************************************************/
+// Single bus, fd based interface
+/********************************************************************************/
+
+static struct fpga_dev *init_dev = NULL;
+
+// Opens the bus once and hands the same fd to every caller
+int fpga_init(char *path, char adr)
+{
+        if (!init_dev)
+                init_dev = fpga_open(path, adr);
+        return init_dev ? init_dev->fd : -1;
+}
+
+// The fd from fpga_init() goes through its context, and so its slave
+// address; any other fd is taken to be an FPGA at FPGA_I2C_ADDR
+static int fd_xfer(int twifd, uint16_t addr, uint8_t *rbuf,
+  const uint8_t *wbuf, int len)
+{
+        if (init_dev && twifd == init_dev->fd)
+                return dev_xfer(init_dev, addr, rbuf, wbuf, len);
+        return fpga_xfer(i2c_ops, twifd, FPGA_I2C_ADDR, addr, rbuf, wbuf, len);
+}
+
+int fpokeN(int twifd, uint16_t addr, const uint8_t *buf, int len)
+{
+        if (fd_xfer(twifd, addr, NULL, buf, len)) {
                 perror("I2C Write Failed");
+                return -1;
         }
+        return 0;
+}
+
+void fpoke8(int twifd, uint16_t addr, uint8_t value)
+{
+        fpokeN(twifd, addr, &value, 1);
+}
+
+int fpeekN(int twifd, uint16_t addr, uint8_t *buf, int len)
+{
+        if (fd_xfer(twifd, addr, buf, NULL, len)) {
+                perror("I2C Read Failed");
+                return -1;
+        }
+        return 0;
 }
 
 uint8_t fpeek8(int twifd, uint16_t addr)
 {
-        uint8_t data[2];
-        data[0] = ((addr >> 8) & 0xff);
-        data[1] = (addr & 0xff);
-        if (write(twifd, data, 2) != 2) {
-                perror("I2C Address set Failed");
+        uint8_t value = 0;
+
+        fpeekN(twifd, addr, &value, 1);
+        return value;
+}
+
+/********************************************************************************/
+// DACs
+/********************************************************************************/
+
+// Each DAC channel is a high nibble / low byte register pair starting at
+// FPGA_DAC_BASE.  Channels in the mask that are next to each other go out
+// in the same burst, so all four update in one transaction.
+int dac_update(struct fpga_dev *dev, unsigned mask,
+  const uint16_t values[FPGA_DAC_CHANNELS])
+{
+        uint8_t buf[FPGA_DAC_CHANNELS * 2];
+        int ch, first, ret = 0;
+
+        for (ch = 0; ch < FPGA_DAC_CHANNELS; ch++) {
+                if (!(mask & (1U << ch)))
+                        continue;
+                first = ch;
+                for (; ch < FPGA_DAC_CHANNELS && (mask & (1U << ch)); ch++) {
+                        buf[(ch - first) * 2] = (values[ch] >> 8) & 0xf;
+                        buf[(ch - first) * 2 + 1] = values[ch] & 0xff;
+                }
+                if (fpga_pokeN(dev, FPGA_DAC_BASE + first * 2, buf,
+                  (ch - first) * 2)) {
+                        perror("DAC update failed");
+                        ret = -1;
+                }
         }
-        read(twifd, data, 1);
+        return ret;
+}
 
-        return data[0];
+int dac_set_all(struct fpga_dev *dev, const uint16_t values[FPGA_DAC_CHANNELS])
+{
+        return dac_update(dev, (1U << FPGA_DAC_CHANNELS) - 1, values);
 }
@@ -1,14 +1,68 @@
 #ifndef __FPGA_H_
 #define __FPGA_H_
 
+#include <stdint.h>
+
+// The FPGA's slave address on /dev/i2c-0
+#define FPGA_I2C_ADDR	0x28
+// Most register bytes one transaction may carry
+#define FPGA_MAX_BURST	128
+// Four 12-bit DACs, two registers each from 0x2E to 0x35
+#define FPGA_DAC_BASE		0x2E
+#define FPGA_DAC_CHANNELS	4
+
 struct cbarpin
 {
         int addr;
         char *name;
 };
 
+// Transport under every FPGA access: open the bus, then I2C_SLAVE_FORCE
+// and I2C_RDWR ioctls.  Replace it, e.g. with the simulator in fpga-sim.h,
+// before fpga_open(); NULL restores the /dev/i2c-N device.
+struct fpga_i2c_ops {
+        int (*open)(const char *path, int flags);
+        int (*close)(int fd);
+        int (*ioctl)(int fd, unsigned long req, void *arg);
+};
+void fpga_set_i2c_ops(const struct fpga_i2c_ops *ops);
+
+// One FPGA on one bus.  Each context has its own fd, slave address and
+// counters, so several FPGAs or buses can be driven from different threads.
+struct fpga_dev;
+
+struct fpga_stats {
+        unsigned long transactions;
+        unsigned long bytes_read;       // register bytes, not counting the
+        unsigned long bytes_written;    // two address bytes
+        unsigned long errors;
+        int last_error;                 // errno of the last failure
+};
+
+// NULL path is /dev/i2c-0, adr 0 is FPGA_I2C_ADDR
+struct fpga_dev *fpga_open(const char *path, int adr);
+void fpga_close(struct fpga_dev *dev);
+int fpga_fd(struct fpga_dev *dev);
+uint8_t fpga_peek8(struct fpga_dev *dev, uint16_t addr);
+int fpga_poke8(struct fpga_dev *dev, uint16_t addr, uint8_t value);
+// Burst read/write of len consecutive registers in one transaction; 0 or -1
+int fpga_peekN(struct fpga_dev *dev, uint16_t addr, uint8_t *buf, int len);
+int fpga_pokeN(struct fpga_dev *dev, uint16_t addr, const uint8_t *buf, int len);
+void fpga_get_stats(struct fpga_dev *dev, struct fpga_stats *st);
+
+// Older fd based interface to a single FPGA.  fpga_init() opens it once and
+// returns the same fd on every call; accesses through that fd use the adr
+// it was given (0 for FPGA_I2C_ADDR).
 int fpga_init(char *path, char adr);
 void fpoke8(int twifd, uint16_t addr, uint8_t value);
 uint8_t fpeek8(int twifd, uint16_t addr);
+int fpeekN(int twifd, uint16_t addr, uint8_t *buf, int len);
+int fpokeN(int twifd, uint16_t addr, const uint8_t *buf, int len);
+
+// Sets the DACs whose bit is set in mask to values[channel]
+int dac_update(struct fpga_dev *dev, unsigned mask,
+  const uint16_t values[FPGA_DAC_CHANNELS]);
+// All four DACs in a single transaction, so they change together
+int dac_set_all(struct fpga_dev *dev, const uint16_t values[FPGA_DAC_CHANNELS]);
 
 #endif
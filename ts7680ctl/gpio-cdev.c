@@ -0,0 +1,545 @@
+/********************************************************************************/
+// gpio-cdev.c
+//	GPIO character device (v2 uAPI) backend for the TS-7680
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpiolib.h"
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+
+#define CDEV_LINES	32		// lines per i.MX28 bank / gpiochip
+#define CDEV_CHIPS	(GPIO_MAX_PINS / CDEV_LINES)
+#define CDEV_EVENT_QUEUE	256	// edges the kernel holds per edge request
+
+// One line request per chip, grown as pins on the chip are touched
+struct cdev_req {
+	int fd;				// -1 while nothing on the chip is requested
+	int nlines;
+	int gpio[CDEV_LINES];
+	uint64_t outmask;		// lines currently configured as outputs
+};
+
+static int sys_open(const char *path, int flags)
+{
+	return open(path, flags);
+}
+
+static int sys_ioctl(int fd, unsigned long req, void *arg)
+{
+	return ioctl(fd, req, arg);
+}
+
+static const struct gpio_cdev_ops cdev_sys_ops = {
+	.open = sys_open,
+	.close = close,
+	.ioctl = sys_ioctl,
+};
+
+static const struct gpio_cdev_ops *cdev_ops = &cdev_sys_ops;
+
+static int chip_fds[CDEV_CHIPS];
+static struct cdev_req reqs[CDEV_CHIPS];
+// gpio -> line index + 1 within its chip's request (0 when not requested)
+static unsigned char pin_line[GPIO_MAX_PINS];
+static int cdev_init = 0;
+
+static void cdev_setup(void)
+{
+	int i;
+
+	if(cdev_init)
+		return;
+	for(i = 0; i < CDEV_CHIPS; i++) {
+		chip_fds[i] = -1;
+		reqs[i].fd = -1;
+	}
+	cdev_init = 1;
+}
+
+static int chip_open(int chip)
+{
+	char buf[32];
+
+	cdev_setup();
+	if(chip_fds[chip] != -1)
+		return chip_fds[chip];
+	snprintf(buf, sizeof(buf), "/dev/gpiochip%d", chip);
+	chip_fds[chip] = cdev_ops->open(buf, O_RDWR | O_CLOEXEC);
+	return chip_fds[chip];
+}
+
+static void release_chip(int chip)
+{
+	struct cdev_req *r = &reqs[chip];
+	int i;
+
+	if(r->fd != -1)
+		cdev_ops->close(r->fd);
+	for(i = 0; i < r->nlines; i++)
+		pin_line[r->gpio[i]] = 0;
+	r->fd = -1;
+	r->nlines = 0;
+	r->outmask = 0;
+}
+
+static void cdev_close_all(void)
+{
+	int i;
+
+	if(!cdev_init)
+		return;
+	for(i = 0; i < CDEV_CHIPS; i++) {
+		release_chip(i);
+		if(chip_fds[i] != -1)
+			cdev_ops->close(chip_fds[i]);
+		chip_fds[i] = -1;
+	}
+}
+
+void gpio_cdev_set_ops(const struct gpio_cdev_ops *ops)
+{
+	cdev_close_all();
+	cdev_ops = ops ? ops : &cdev_sys_ops;
+}
+
+// Output lines are driven to the matching bit of values; the kernel drives
+// them low when a config carries no output values
+static void fill_config(struct gpio_v2_line_config *cfg, uint64_t outmask,
+  uint64_t allmask, uint64_t values)
+{
+	int k;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->flags = GPIO_V2_LINE_FLAG_INPUT;
+	if(outmask == allmask) {
+		cfg->flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	} else if(outmask) {
+		cfg->num_attrs = 1;
+		cfg->attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+		cfg->attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+		cfg->attrs[0].mask = outmask;
+	}
+	if(outmask) {
+		k = cfg->num_attrs++;
+		cfg->attrs[k].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		cfg->attrs[k].attr.values = values & outmask;
+		cfg->attrs[k].mask = outmask;
+	}
+}
+
+static uint64_t line_mask(int n)
+{
+	return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+// Levels the request's output lines are driven to right now
+static int out_values(struct cdev_req *r, uint64_t *values)
+{
+	struct gpio_v2_line_values v;
+
+	*values = 0;
+	if(r->fd == -1 || !r->outmask)
+		return 0;
+	v.mask = r->outmask;
+	v.bits = 0;
+	if(cdev_ops->ioctl(r->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0) {
+		perror("GPIO Read Failed");
+		return -1;
+	}
+	*values = v.bits & v.mask;
+	return 0;
+}
+
+// Add pins[0..n), which must all live on chip and be unrequested, to the
+// chip's line request.  A live request can't grow, so the old one is
+// released and the whole set requested again; lines that were outputs
+// come back as outputs at the level they were driven to.
+static int request_chip(int chip, const int *pins, int n, int dir)
+{
+	struct gpio_v2_line_request lr;
+	struct cdev_req *r = &reqs[chip];
+	uint64_t outmask, values;
+	int i, cfd, nlines = r->nlines + n;
+
+	cfd = chip_open(chip);
+	if(cfd < 0) {
+		fprintf(stderr, "/dev/gpiochip%d: %s\n", chip, strerror(errno));
+		return -1;
+	}
+	if(out_values(r, &values))
+		return -1;
+
+	memset(&lr, 0, sizeof(lr));
+	strcpy(lr.consumer, "ts7680ctl");
+	lr.num_lines = nlines;
+	for(i = 0; i < r->nlines; i++)
+		lr.offsets[i] = r->gpio[i] % CDEV_LINES;
+	for(i = 0; i < n; i++)
+		lr.offsets[r->nlines + i] = pins[i] % CDEV_LINES;
+	outmask = r->outmask;
+	if(dir)
+		outmask |= line_mask(nlines) & ~line_mask(r->nlines);
+	fill_config(&lr.config, outmask, line_mask(nlines), values);
+
+	if(r->fd != -1) {
+		cdev_ops->close(r->fd);
+		r->fd = -1;
+	}
+	if(cdev_ops->ioctl(cfd, GPIO_V2_GET_LINE_IOCTL, &lr) < 0) {
+		perror("GPIO line request failed");
+		// The old lines are gone too; they are requested again when next used
+		release_chip(chip);
+		return -1;
+	}
+
+	r->fd = lr.fd;
+	r->outmask = outmask;
+	for(i = 0; i < n; i++)
+		r->gpio[r->nlines + i] = pins[i];
+	r->nlines = nlines;
+	for(i = 0; i < nlines; i++)
+		pin_line[r->gpio[i]] = i + 1;
+	return 0;
+}
+
+int gpio_cdev_request(const int *pins, int n, int dir)
+{
+	uint32_t seen[CDEV_CHIPS];
+	int group[CDEV_LINES];
+	int chip, i, k;
+
+	memset(seen, 0, sizeof(seen));
+	for(i = 0; i < n; i++) {
+		if(pins[i] < 0 || pins[i] >= GPIO_MAX_PINS)
+			return -1;
+		if(seen[pins[i] / CDEV_LINES] >> pins[i] % CDEV_LINES & 1) {
+			fprintf(stderr, "gpio %d listed twice\n", pins[i]);
+			errno = EINVAL;
+			return -1;
+		}
+		seen[pins[i] / CDEV_LINES] |= 1U << pins[i] % CDEV_LINES;
+	}
+
+	cdev_setup();
+	// Grow each chip's request by every new pin on it at once
+	for(chip = 0; chip < CDEV_CHIPS; chip++) {
+		for(i = 0, k = 0; i < n; i++) {
+			if(pins[i] / CDEV_LINES != chip || pin_line[pins[i]])
+				continue;
+			group[k++] = pins[i];
+		}
+		if(k && request_chip(chip, group, k, dir))
+			return -1;
+	}
+	return 0;
+}
+
+static int cdev_pin_mode(int gpio, int dir)
+{
+	struct gpio_v2_line_config cfg;
+	struct cdev_req *r;
+	uint64_t outmask, values;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	if(!pin_line[gpio])
+		return gpio_cdev_request(&gpio, 1, dir);
+
+	r = &reqs[gpio / CDEV_LINES];
+	outmask = r->outmask;
+	if(dir)
+		outmask |= 1ULL << (pin_line[gpio] - 1);
+	else
+		outmask &= ~(1ULL << (pin_line[gpio] - 1));
+	if(outmask == r->outmask)
+		return 0;
+
+	// The config covers every line, so carry the other outputs' levels
+	if(out_values(r, &values))
+		return -2;
+	fill_config(&cfg, outmask, line_mask(r->nlines), values);
+	if(cdev_ops->ioctl(r->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &cfg) < 0) {
+		perror("Couldn't set GPIO direction");
+		return -2;
+	}
+	r->outmask = outmask;
+	return 0;
+}
+
+static int cdev_read(int gpio)
+{
+	struct gpio_v2_line_values v;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	if(!pin_line[gpio] && gpio_cdev_request(&gpio, 1, 0))
+		return -1;
+
+	v.mask = 1ULL << (pin_line[gpio] - 1);
+	v.bits = 0;
+	if(cdev_ops->ioctl(reqs[gpio / CDEV_LINES].fd,
+	  GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0) {
+		perror("GPIO Read Failed");
+		return -1;
+	}
+	return !!(v.bits & v.mask);
+}
+
+static int cdev_write(int gpio, int val)
+{
+	struct gpio_v2_line_values v;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return 1;
+	if(!pin_line[gpio] && gpio_cdev_request(&gpio, 1, 1))
+		return 1;
+
+	v.mask = 1ULL << (pin_line[gpio] - 1);
+	v.bits = val ? v.mask : 0;
+	if(cdev_ops->ioctl(reqs[gpio / CDEV_LINES].fd,
+	  GPIO_V2_LINE_SET_VALUES_IOCTL, &v) < 0) {
+		perror("failed to set gpio");
+		return 1;
+	}
+	return 0;
+}
+
+// Translate pins[] into per-chip line masks, requesting any pin that isn't
+// requested yet.  reqmask[c] gets the lines of chip c's request, and
+// pinbit[c][line] the matching bit index in pins[].
+static int map_pins(const int *pins, int n, int dir, uint64_t *reqmask,
+  signed char pinbit[][CDEV_LINES])
+{
+	int i, c, line, missing[64], k = 0;
+
+	if(n > 64)
+		return -1;
+	for(i = 0; i < n; i++) {
+		if(pins[i] < 0 || pins[i] >= GPIO_MAX_PINS)
+			return -1;
+		if(!pin_line[pins[i]])
+			missing[k++] = pins[i];
+	}
+	if(k && gpio_cdev_request(missing, k, dir))
+		return -1;
+
+	memset(reqmask, 0, sizeof(uint64_t) * CDEV_CHIPS);
+	for(i = 0; i < n; i++) {
+		c = pins[i] / CDEV_LINES;
+		line = pin_line[pins[i]] - 1;
+		reqmask[c] |= 1ULL << line;
+		pinbit[c][line] = i;
+	}
+	return 0;
+}
+
+static int cdev_read_mask(const int *pins, int n, uint64_t *out)
+{
+	static signed char pinbit[CDEV_CHIPS][CDEV_LINES];
+	uint64_t reqmask[CDEV_CHIPS];
+	struct gpio_v2_line_values v;
+	int c, line;
+
+	if(map_pins(pins, n, 0, reqmask, pinbit))
+		return -1;
+
+	*out = 0;
+	for(c = 0; c < CDEV_CHIPS; c++) {
+		if(!reqmask[c])
+			continue;
+		v.mask = reqmask[c];
+		v.bits = 0;
+		if(cdev_ops->ioctl(reqs[c].fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0) {
+			perror("GPIO Read Failed");
+			return -1;
+		}
+		for(line = 0; line < reqs[c].nlines; line++) {
+			if((v.mask & v.bits) >> line & 1)
+				*out |= 1ULL << pinbit[c][line];
+		}
+	}
+	return 0;
+}
+
+static int cdev_write_mask(const int *pins, int n, uint64_t mask, uint64_t values)
+{
+	static signed char pinbit[CDEV_CHIPS][CDEV_LINES];
+	uint64_t reqmask[CDEV_CHIPS];
+	struct gpio_v2_line_values v;
+	int c, line, bit;
+
+	if(map_pins(pins, n, 1, reqmask, pinbit))
+		return -1;
+
+	for(c = 0; c < CDEV_CHIPS; c++) {
+		v.mask = 0;
+		v.bits = 0;
+		for(line = 0; line < reqs[c].nlines; line++) {
+			if(!(reqmask[c] >> line & 1))
+				continue;
+			bit = pinbit[c][line];
+			if(!(mask >> bit & 1))
+				continue;
+			v.mask |= 1ULL << line;
+			if(values >> bit & 1)
+				v.bits |= 1ULL << line;
+		}
+		if(!v.mask)
+			continue;
+		if(cdev_ops->ioctl(reqs[c].fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v) < 0) {
+			perror("failed to set gpio");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int gpio_cdev_request_edges(int gpio, int rising, int falling, int *value)
+{
+	struct gpio_v2_line_request lr;
+	int cfd, level;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS || !(rising || falling)) {
+		errno = EINVAL;
+		return -1;
+	}
+	// Already held by the access request on its chip
+	if(pin_line[gpio]) {
+		errno = EBUSY;
+		return -1;
+	}
+	cfd = chip_open(gpio / CDEV_LINES);
+	if(cfd < 0)
+		return -1;
+
+	memset(&lr, 0, sizeof(lr));
+	strcpy(lr.consumer, "ts7680ctl");
+	lr.num_lines = 1;
+	lr.offsets[0] = gpio % CDEV_LINES;
+	lr.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+	  (rising ? GPIO_V2_LINE_FLAG_EDGE_RISING : 0) |
+	  (falling ? GPIO_V2_LINE_FLAG_EDGE_FALLING : 0);
+	lr.event_buffer_size = CDEV_EVENT_QUEUE;
+	if(cdev_ops->ioctl(cfd, GPIO_V2_GET_LINE_IOCTL, &lr) < 0)
+		return -1;
+
+	level = gpio_cdev_edge_level(lr.fd);
+	if(level < 0) {
+		cdev_ops->close(lr.fd);
+		return -1;
+	}
+	*value = level;
+	return lr.fd;
+}
+
+int gpio_cdev_read_edges(int fd, struct gpio_cdev_edge *out, int max)
+{
+	struct gpio_v2_line_event ev[16];
+	ssize_t len;
+	int i, n;
+
+	if(max > 16)
+		max = 16;
+	len = read(fd, ev, max * sizeof(ev[0]));
+	if(len < 0)
+		return -1;
+	n = len / sizeof(ev[0]);
+	for(i = 0; i < n; i++) {
+		out[i].ns = ev[i].timestamp_ns;
+		out[i].seq = ev[i].line_seqno;
+		out[i].value = ev[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+	}
+	return n;
+}
+
+int gpio_cdev_edge_level(int fd)
+{
+	struct gpio_v2_line_values v;
+
+	v.mask = 1;
+	v.bits = 0;
+	if(cdev_ops->ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0)
+		return -1;
+	return v.bits & 1;
+}
+
+#else // !GPIO_V2_GET_LINE_IOCTL
+
+// Kernel headers predate the v2 uAPI; the backend exists but always fails
+
+void gpio_cdev_set_ops(const struct gpio_cdev_ops *ops)
+{
+	(void)ops;
+}
+
+int gpio_cdev_request(const int *pins, int n, int dir)
+{
+	(void)pins; (void)n; (void)dir;
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_cdev_request_edges(int gpio, int rising, int falling, int *value)
+{
+	(void)gpio; (void)rising; (void)falling; (void)value;
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_cdev_read_edges(int fd, struct gpio_cdev_edge *out, int max)
+{
+	(void)fd; (void)out; (void)max;
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_cdev_edge_level(int fd)
+{
+	(void)fd;
+	errno = ENOSYS;
+	return -1;
+}
+
+static void cdev_close_all(void)
+{
+}
+
+static int cdev_pin_mode(int gpio, int dir)
+{
+	return gpio_cdev_request(&gpio, 1, dir);
+}
+
+static int cdev_read(int gpio)
+{
+	return gpio_cdev_request(&gpio, 1, 0);
+}
+
+static int cdev_write(int gpio, int val)
+{
+	return gpio_cdev_request(&gpio, 1, val) ? 1 : 0;
+}
+
+#endif // GPIO_V2_GET_LINE_IOCTL
+
+const struct gpio_backend gpio_cdev_backend = {
+	.name = "cdev",
+	.pin_mode = cdev_pin_mode,
+	.read = cdev_read,
+	.write = cdev_write,
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	.read_mask = cdev_read_mask,
+	.write_mask = cdev_write_mask,
+#endif
+	.close = cdev_close_all,
+};
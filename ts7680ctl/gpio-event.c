@@ -0,0 +1,487 @@
+/********************************************************************************/
+// gpio-event.c
+//	epoll based edge event loop for character device and sysfs GPIO
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "gpiolib.h"
+#include "gpio-event.h"
+#include "gpio-ring.h"
+
+#define EVENT_WAKEUP	UINT32_MAX
+#define EVENT_TIMER	(UINT32_MAX - 1)
+#define EVENT_BATCH	16
+
+struct gpio_event_pin {
+	int gpio;
+	int fd;			// -1 for a free slot
+	int cdev;		// fd is a cdev edge request, else a sysfs value file
+	int both;		// watching rising and falling edges
+	gpio_event_cb cb;
+	void *arg;
+	uint64_t debounce_ns;	// 0 delivers every edge
+	uint64_t deadline;	// pending level qualifies at this time, 0 if none
+	uint64_t edge_ns;	// time of the last raw edge
+	uint32_t seq;		// edges seen on the pin, lost ones included
+	int level;		// last raw level
+	int stable;		// last level delivered
+	int pending;
+};
+
+struct gpio_event_loop {
+	int epfd;
+	int wakefd;
+	int npins;
+	int maxpins;
+	struct gpio_event_pin *pins;
+	struct gpio_edge_ring *ring;
+	pthread_t thread;
+	int running;
+	int timerfd;		// shared debounce timer, -1 until first used
+	uint64_t armed;		// absolute expiry the timer is set to, 0 if idle
+	unsigned long raw_events;
+	unsigned long delivered;
+};
+
+struct gpio_event_loop *gpio_event_loop_new(void)
+{
+	struct gpio_event_loop *loop;
+	struct epoll_event ev;
+
+	loop = calloc(1, sizeof(*loop));
+	if(!loop)
+		return NULL;
+
+	loop->timerfd = -1;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	loop->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(loop->epfd < 0 || loop->wakefd < 0) {
+		perror("Couldn't create event loop");
+		goto err;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EVENT_WAKEUP;
+	if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0) {
+		perror("Couldn't add wakeup fd");
+		goto err;
+	}
+	return loop;
+
+err:
+	if(loop->epfd >= 0)
+		close(loop->epfd);
+	if(loop->wakefd >= 0)
+		close(loop->wakefd);
+	free(loop);
+	return NULL;
+}
+
+static void close_pin(struct gpio_event_pin *p)
+{
+	close(p->fd);
+	p->fd = -1;
+	if(!p->cdev)
+		gpio_release(p->gpio);
+}
+
+void gpio_event_loop_free(struct gpio_event_loop *loop)
+{
+	int i;
+
+	if(!loop)
+		return;
+	gpio_event_stop(loop);
+	for(i = 0; i < loop->npins; i++) {
+		if(loop->pins[i].fd >= 0)
+			close_pin(&loop->pins[i]);
+	}
+	if(loop->timerfd >= 0)
+		close(loop->timerfd);
+	close(loop->wakefd);
+	close(loop->epfd);
+	free(loop->pins);
+	free(loop);
+}
+
+static struct gpio_event_pin *find_pin(struct gpio_event_loop *loop, int gpio)
+{
+	int i;
+
+	for(i = 0; i < loop->npins; i++) {
+		if(loop->pins[i].fd >= 0 && loop->pins[i].gpio == gpio)
+			return &loop->pins[i];
+	}
+	return NULL;
+}
+
+static int alloc_slot(struct gpio_event_loop *loop)
+{
+	struct gpio_event_pin *p;
+	int i;
+
+	for(i = 0; i < loop->npins; i++) {
+		if(loop->pins[i].fd < 0)
+			return i;
+	}
+	if(loop->npins == loop->maxpins) {
+		i = loop->maxpins ? loop->maxpins * 2 : 16;
+		p = realloc(loop->pins, i * sizeof(*p));
+		if(!p)
+			return -1;
+		loop->pins = p;
+		loop->maxpins = i;
+	}
+	return loop->npins++;
+}
+
+int gpio_event_add(struct gpio_event_loop *loop, int gpio, int rising,
+  int falling, gpio_event_cb cb, void *arg)
+{
+	struct gpio_event_pin *p;
+	struct epoll_event ev;
+	char buf[96];
+	int slot, fd, value, cdev = 1;
+
+	if(loop->running)
+		return -1;
+	if(find_pin(loop, gpio)) {
+		fprintf(stderr, "gpio %d is already in the event loop\n", gpio);
+		return -1;
+	}
+
+	fd = gpio_cdev_request_edges(gpio, rising, falling, &value);
+	if(fd < 0) {
+		// No v2 character device, or the pin is exported: the sysfs
+		// value file only says that something changed
+		cdev = 0;
+		if(gpio_claim(gpio) < 0 || gpio_setedge(gpio, rising, falling))
+			return -1;
+		snprintf(buf, sizeof(buf), "%s/gpio%d/value", gpio_sysfs_root(), gpio);
+		fd = open(buf, O_RDONLY | O_CLOEXEC);
+		if(fd < 0) {
+			perror("Couldn't open the value file");
+			gpio_release(gpio);
+			return -1;
+		}
+		// Read first since there is always an initial status
+		if(pread(fd, buf, sizeof(buf), 0) < 1)
+			buf[0] = '0';
+		value = buf[0] == '1';
+	}
+
+	slot = alloc_slot(loop);
+	if(slot < 0)
+		goto err;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = cdev ? EPOLLIN : EPOLLPRI | EPOLLERR;
+	ev.data.u32 = slot;
+	if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("Couldn't add gpio to event loop");
+		loop->pins[slot].fd = -1;
+		goto err;
+	}
+
+	p = &loop->pins[slot];
+	p->gpio = gpio;
+	p->fd = fd;
+	p->cdev = cdev;
+	p->both = rising && falling;
+	p->cb = cb;
+	p->arg = arg;
+	p->debounce_ns = 0;
+	p->deadline = 0;
+	p->seq = 0;
+	p->level = value;
+	p->stable = value;
+	p->pending = value;
+	return 0;
+
+err:
+	close(fd);
+	if(!cdev)
+		gpio_release(gpio);
+	return -1;
+}
+
+int gpio_event_remove(struct gpio_event_loop *loop, int gpio)
+{
+	struct gpio_event_pin *p = find_pin(loop, gpio);
+
+	if(!p || loop->running)
+		return -1;
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, p->fd, NULL);
+	close_pin(p);
+	return 0;
+}
+
+int gpio_event_level(struct gpio_event_loop *loop, int gpio)
+{
+	struct gpio_event_pin *p = find_pin(loop, gpio);
+
+	return p ? p->stable : -1;
+}
+
+static void deliver(struct gpio_event_loop *loop, struct gpio_event_pin *p,
+  int value, uint64_t ns)
+{
+	if(loop->ring)
+		gpio_ring_push(loop->ring, p->gpio, value, ns);
+	loop->delivered++;
+	if(p->cb)
+		p->cb(p->gpio, value, ns, p->seq, p->arg);
+}
+
+static int read_level(struct gpio_event_pin *p)
+{
+	char val[4];
+
+	if(p->cdev)
+		return gpio_cdev_edge_level(p->fd);
+	if(pread(p->fd, val, sizeof(val), 0) < 1)
+		return -1;
+	return val[0] == '1';
+}
+
+// Point the shared timer at the earliest pending debounce deadline
+static void rearm_timer(struct gpio_event_loop *loop)
+{
+	struct itimerspec its;
+	uint64_t next = 0;
+	int i;
+
+	for(i = 0; i < loop->npins; i++) {
+		if(loop->pins[i].fd < 0 || !loop->pins[i].deadline)
+			continue;
+		if(!next || loop->pins[i].deadline < next)
+			next = loop->pins[i].deadline;
+	}
+	if(next == loop->armed)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = next / 1000000000ULL;
+	its.it_value.tv_nsec = next % 1000000000ULL;
+	timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	loop->armed = next;
+}
+
+// Deliver every pin whose level has held for its full window
+static int expire_debounce(struct gpio_event_loop *loop, uint64_t now)
+{
+	struct gpio_event_pin *p;
+	int i, value, ran = 0;
+
+	for(i = 0; i < loop->npins; i++) {
+		p = &loop->pins[i];
+		if(p->fd < 0 || !p->deadline || p->deadline > now)
+			continue;
+		p->deadline = 0;
+		// An edge may have been lost to coalescing; trust the line itself
+		value = read_level(p);
+		if(value >= 0)
+			p->pending = value;
+		if(p->pending == p->stable)
+			continue;
+		p->stable = p->pending;
+		deliver(loop, p, p->stable, p->edge_ns);
+		ran++;
+	}
+	return ran;
+}
+
+// One edge at ns; returns 1 if it went straight to the callback
+static int edge(struct gpio_event_loop *loop, struct gpio_event_pin *p,
+  int value, uint64_t ns)
+{
+	p->level = value;
+	if(!p->debounce_ns) {
+		p->stable = value;
+		deliver(loop, p, value, ns);
+		return 1;
+	}
+	// Every bounce restarts the pin's stable-time window
+	p->pending = value;
+	p->edge_ns = ns;
+	p->deadline = ns + p->debounce_ns;
+	return 0;
+}
+
+// The kernel queued each edge with its own timestamp and numbered them per
+// line, so a jump in the number is edges the queue overflowed
+static int cdev_edges(struct gpio_event_loop *loop, struct gpio_event_pin *p)
+{
+	struct gpio_cdev_edge e[EVENT_BATCH];
+	int i, n, ran = 0;
+
+	n = gpio_cdev_read_edges(p->fd, e, EVENT_BATCH);
+	for(i = 0; i < n; i++) {
+		loop->raw_events += e[i].seq - p->seq;
+		p->seq = e[i].seq;
+		ran += edge(loop, p, e[i].value, e[i].ns);
+	}
+	return ran;
+}
+
+int gpio_event_wait(struct gpio_event_loop *loop, int timeout_ms)
+{
+	struct epoll_event ev[EVENT_BATCH];
+	struct gpio_event_pin *p;
+	uint64_t cnt, ns;
+	unsigned edges;
+	char val[4];
+	int i, n, value, ran = 0, timer = 0;
+
+	do {
+		n = epoll_wait(loop->epfd, ev, EVENT_BATCH, timeout_ms);
+	} while(n < 0 && errno == EINTR);
+	if(n < 0) {
+		perror("epoll_wait");
+		return -1;
+	}
+	// One timestamp for the batch, taken as close to the wakeup as we can
+	ns = gpio_ring_now();
+
+	for(i = 0; i < n; i++) {
+		if(ev[i].data.u32 == EVENT_WAKEUP) {
+			read(loop->wakefd, &cnt, sizeof(cnt));
+			continue;
+		}
+		if(ev[i].data.u32 == EVENT_TIMER) {
+			read(loop->timerfd, &cnt, sizeof(cnt));
+			timer = 1;
+			continue;
+		}
+		p = &loop->pins[ev[i].data.u32];
+		// Removed by an earlier callback in this batch
+		if(p->fd < 0)
+			continue;
+		if(p->cdev) {
+			ran += cdev_edges(loop, p);
+			continue;
+		}
+		// Rereading from offset 0 both clears the event and gets the level
+		if(pread(p->fd, val, sizeof(val), 0) < 1)
+			continue;
+		value = val[0] == '1';
+		// Edges before the reread are merged into one wakeup.  Watching
+		// both, an unchanged level means at least two went by.
+		edges = p->both && value == p->level ? 2 : 1;
+		loop->raw_events += edges;
+		p->seq += edges;
+		ran += edge(loop, p, value, ns);
+	}
+
+	if(loop->timerfd >= 0) {
+		if(timer || (loop->armed && loop->armed <= ns))
+			ran += expire_debounce(loop, ns);
+		rearm_timer(loop);
+	}
+	return ran;
+}
+
+int gpio_event_set_debounce(struct gpio_event_loop *loop, int gpio,
+  unsigned stable_us)
+{
+	struct gpio_event_pin *p = find_pin(loop, gpio);
+	struct epoll_event ev;
+
+	if(!p || loop->running)
+		return -1;
+
+	if(stable_us && loop->timerfd < 0) {
+		loop->timerfd = timerfd_create(CLOCK_MONOTONIC,
+		  TFD_CLOEXEC | TFD_NONBLOCK);
+		if(loop->timerfd < 0) {
+			perror("Couldn't create debounce timer");
+			return -1;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = EVENT_TIMER;
+		if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timerfd, &ev) < 0) {
+			perror("Couldn't add debounce timer");
+			close(loop->timerfd);
+			loop->timerfd = -1;
+			return -1;
+		}
+	}
+
+	p->debounce_ns = (uint64_t)stable_us * 1000;
+	p->deadline = 0;
+	return 0;
+}
+
+void gpio_event_stats(struct gpio_event_loop *loop, unsigned long *raw,
+  unsigned long *delivered)
+{
+	if(raw)
+		*raw = loop->raw_events;
+	if(delivered)
+		*delivered = loop->delivered;
+}
+
+int gpio_event_wakeup(struct gpio_event_loop *loop)
+{
+	uint64_t one = 1;
+
+	return write(loop->wakefd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+int gpio_event_fd(struct gpio_event_loop *loop)
+{
+	return loop->epfd;
+}
+
+void gpio_event_set_ring(struct gpio_event_loop *loop, struct gpio_edge_ring *ring)
+{
+	loop->ring = ring;
+}
+
+static void *event_thread(void *arg)
+{
+	struct gpio_event_loop *loop = arg;
+
+	while(__atomic_load_n(&loop->running, __ATOMIC_ACQUIRE)) {
+		if(gpio_event_wait(loop, -1) < 0)
+			break;
+	}
+	return NULL;
+}
+
+int gpio_event_start(struct gpio_event_loop *loop)
+{
+	if(loop->running)
+		return -1;
+	loop->running = 1;
+	if(pthread_create(&loop->thread, NULL, event_thread, loop)) {
+		loop->running = 0;
+		perror("Couldn't start event thread");
+		return -1;
+	}
+	return 0;
+}
+
+void gpio_event_stop(struct gpio_event_loop *loop)
+{
+	if(!loop->running)
+		return;
+	__atomic_store_n(&loop->running, 0, __ATOMIC_RELEASE);
+	gpio_event_wakeup(loop);
+	pthread_join(loop->thread, NULL);
+}
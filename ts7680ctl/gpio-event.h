@@ -0,0 +1,59 @@
+#ifndef _GPIO_EVENT_H_
+#define _GPIO_EVENT_H_
+
+#include <stdint.h>
+
+// Edge event loop: any number of pins on one epoll instance.  Each pin gets
+// a character device edge request of its own where the kernel has the v2
+// uAPI and the pin isn't exported; the kernel then queues every edge with a
+// timestamp.  Otherwise the pin is exported and its sysfs value file
+// watched, where edges that come close together merge into one wakeup.
+
+struct gpio_event_loop;
+struct gpio_edge_ring;
+
+// ns is CLOCK_MONOTONIC: the kernel's time of the edge for a character
+// device pin, the wakeup for a sysfs one.  seq counts the edges seen on the
+// pin so far; a step of more than one means the ones in between were lost
+// (merged by sysfs, which can only tell when watching both edges, or
+// overflowed from the kernel's queue).
+typedef void (*gpio_event_cb)(int gpio, int value, uint64_t ns, uint32_t seq,
+  void *arg);
+
+struct gpio_event_loop *gpio_event_loop_new(void);
+void gpio_event_loop_free(struct gpio_event_loop *loop);
+// Requests or exports the pin with the given edges and starts watching it.
+// Should be given both edges if the pin is going to be debounced.
+int gpio_event_add(struct gpio_event_loop *loop, int gpio, int rising,
+  int falling, gpio_event_cb cb, void *arg);
+int gpio_event_remove(struct gpio_event_loop *loop, int gpio);
+// Last level delivered for the pin (its level when added, before any
+// edge), or -1 if it isn't in the loop
+int gpio_event_level(struct gpio_event_loop *loop, int gpio);
+// Only deliver a new level after it has held for stable_us without another
+// edge; 0 turns debouncing off.  All pins share one timerfd.
+int gpio_event_set_debounce(struct gpio_event_loop *loop, int gpio,
+  unsigned stable_us);
+// Edges seen from the kernel, lost ones included, vs transitions handed to
+// callbacks/the ring
+void gpio_event_stats(struct gpio_event_loop *loop, unsigned long *raw,
+  unsigned long *delivered);
+// Waits up to timeout_ms (-1 forever) and runs the callbacks of every pin
+// that fired.  Returns the number of callbacks run, 0 on timeout or wakeup,
+// -1 on error.
+int gpio_event_wait(struct gpio_event_loop *loop, int timeout_ms);
+// Makes a blocked gpio_event_wait() return; safe from any thread
+int gpio_event_wakeup(struct gpio_event_loop *loop);
+// The epoll fd, for nesting the loop in another poll/epoll set
+int gpio_event_fd(struct gpio_event_loop *loop);
+
+// Also push every event into ring (see gpio-ring.h), stamped as for the
+// callbacks.  NULL stops recording.
+void gpio_event_set_ring(struct gpio_event_loop *loop, struct gpio_edge_ring *ring);
+// Run gpio_event_wait() on a thread of its own until gpio_event_stop().
+// Pins can't be added or removed while it runs; drain the ring from the
+// application thread meanwhile.
+int gpio_event_start(struct gpio_event_loop *loop);
+void gpio_event_stop(struct gpio_event_loop *loop);
+
+#endif //_GPIO_EVENT_H_
@@ -0,0 +1,245 @@
+/********************************************************************************/
+// gpio-mmap.c
+//	i.MX28 PINCTRL register backend for the TS-7680
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gpiolib.h"
+
+// Register offsets in bytes from the PINCTRL base, one block per bank of
+// 32 pins.  Each register has SET/CLR aliases at +4/+8 that update only the
+// bits written, atomically with respect to everything else.
+#define PINCTRL_MUXSEL		0x100	// two registers per bank, 2 bits per pin
+#define PINCTRL_DOUT		0x700
+#define PINCTRL_DIN		0x900
+#define PINCTRL_DOE		0xb00
+#define PINCTRL_BANK		0x10
+#define PINCTRL_SET		0x4
+#define PINCTRL_CLR		0x8
+#define PINCTRL_BANKS		5
+#define PINCTRL_WINDOW		0x2000
+
+static char mm_path[64] = "/dev/mem";
+static long mm_offset = GPIO_MMAP_PINCTRL_BASE;
+static volatile uint32_t *mm_regs = NULL;
+// A plain file has no SET/CLR hardware behind it, so do the same update
+// on the register itself, and let DIN of an output follow DOUT
+static int mm_emulate = 0;
+
+static volatile uint32_t *reg(int off)
+{
+	return mm_regs + off / 4;
+}
+
+static void reg_set(int off, uint32_t bits)
+{
+	if(mm_emulate)
+		__atomic_fetch_or(reg(off), bits, __ATOMIC_SEQ_CST);
+	else
+		*reg(off + PINCTRL_SET) = bits;
+}
+
+static void reg_clr(int off, uint32_t bits)
+{
+	if(mm_emulate)
+		__atomic_fetch_and(reg(off), ~bits, __ATOMIC_SEQ_CST);
+	else
+		*reg(off + PINCTRL_CLR) = bits;
+}
+
+// Raises set and lowers clr in one store, so no other level combination
+// ever appears on the pins.  The load and store aren't atomic on the bus:
+// a SET/CLR from another writer to the same bank in between is lost.
+static void reg_update(int off, uint32_t set, uint32_t clr)
+{
+	uint32_t old;
+
+	if(mm_emulate) {
+		old = __atomic_load_n(reg(off), __ATOMIC_SEQ_CST);
+		while(!__atomic_compare_exchange_n(reg(off), &old,
+		  (old & ~clr) | set, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			;
+	} else {
+		*reg(off) = (*reg(off) & ~clr) | set;
+	}
+}
+
+static void mm_close(void)
+{
+	if(mm_regs)
+		munmap((void *)mm_regs, PINCTRL_WINDOW);
+	mm_regs = NULL;
+}
+
+static int mm_map(void)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if(mm_regs)
+		return 0;
+	fd = open(mm_path, O_RDWR | O_SYNC | O_CLOEXEC);
+	if(fd < 0 || fstat(fd, &st)) {
+		perror(mm_path);
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	mm_emulate = S_ISREG(st.st_mode);
+	if(mm_emulate && st.st_size < mm_offset + PINCTRL_WINDOW &&
+	  ftruncate(fd, mm_offset + PINCTRL_WINDOW)) {
+		perror(mm_path);
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, PINCTRL_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+	  mm_offset);
+	close(fd);
+	if(p == MAP_FAILED) {
+		perror("Couldn't map PINCTRL");
+		return -1;
+	}
+	mm_regs = p;
+	return 0;
+}
+
+int gpio_mmap_set_window(const char *path, long offset)
+{
+	mm_close();
+	if(!path) {
+		path = "/dev/mem";
+		offset = GPIO_MMAP_PINCTRL_BASE;
+	}
+	if(strlen(path) >= sizeof(mm_path) || offset % getpagesize())
+		return -1;
+	strcpy(mm_path, path);
+	mm_offset = offset;
+	return 0;
+}
+
+static int mm_check(int gpio)
+{
+	if(gpio < 0 || gpio >= PINCTRL_BANKS * 32)
+		return -1;
+	return mm_map();
+}
+
+static int mm_pin_mode(int gpio, int dir)
+{
+	int bank = gpio / 32, bit = gpio % 32;
+
+	if(mm_check(gpio))
+		return -1;
+	// Both mux bits set selects the GPIO function
+	reg_set(PINCTRL_MUXSEL + (bank * 2 + bit / 16) * PINCTRL_BANK,
+	  3U << (bit % 16) * 2);
+	if(dir)
+		reg_set(PINCTRL_DOE + bank * PINCTRL_BANK, 1U << bit);
+	else
+		reg_clr(PINCTRL_DOE + bank * PINCTRL_BANK, 1U << bit);
+	return 0;
+}
+
+static uint32_t mm_din(int bank)
+{
+	uint32_t din = *reg(PINCTRL_DIN + bank * PINCTRL_BANK);
+	uint32_t doe;
+
+	if(mm_emulate) {
+		doe = *reg(PINCTRL_DOE + bank * PINCTRL_BANK);
+		din = (din & ~doe) | (*reg(PINCTRL_DOUT + bank * PINCTRL_BANK) & doe);
+	}
+	return din;
+}
+
+static int mm_read(int gpio)
+{
+	if(mm_check(gpio))
+		return -1;
+	return mm_din(gpio / 32) >> (gpio % 32) & 1;
+}
+
+static int mm_write(int gpio, int val)
+{
+	if(mm_check(gpio))
+		return 1;
+	if(val)
+		reg_set(PINCTRL_DOUT + gpio / 32 * PINCTRL_BANK, 1U << (gpio % 32));
+	else
+		reg_clr(PINCTRL_DOUT + gpio / 32 * PINCTRL_BANK, 1U << (gpio % 32));
+	return 0;
+}
+
+static int mm_read_mask(const int *pins, int n, uint64_t *out)
+{
+	uint32_t din[PINCTRL_BANKS];
+	int i, bank, read = 0;
+
+	for(i = 0; i < n; i++) {
+		if(mm_check(pins[i]))
+			return -1;
+	}
+	// One load per bank, so pins on the same bank are a coherent snapshot
+	*out = 0;
+	for(i = 0; i < n; i++) {
+		bank = pins[i] / 32;
+		if(!(read & 1 << bank)) {
+			din[bank] = mm_din(bank);
+			read |= 1 << bank;
+		}
+		if(din[bank] >> (pins[i] % 32) & 1)
+			*out |= 1ULL << i;
+	}
+	return 0;
+}
+
+static int mm_write_mask(const int *pins, int n, uint64_t mask, uint64_t values)
+{
+	uint32_t set[PINCTRL_BANKS], clr[PINCTRL_BANKS];
+	int i, bank;
+
+	memset(set, 0, sizeof(set));
+	memset(clr, 0, sizeof(clr));
+	for(i = 0; i < n; i++) {
+		if(!(mask >> i & 1))
+			continue;
+		if(mm_check(pins[i]))
+			return -1;
+		if(values >> i & 1)
+			set[pins[i] / 32] |= 1U << (pins[i] % 32);
+		else
+			clr[pins[i] / 32] |= 1U << (pins[i] % 32);
+	}
+	// A bank going one way takes a single SET or CLR write; one with
+	// pins going both ways is a single DOUT store, since CLR then SET
+	// would pass through all of them low
+	for(bank = 0; bank < PINCTRL_BANKS; bank++) {
+		if(clr[bank] && set[bank])
+			reg_update(PINCTRL_DOUT + bank * PINCTRL_BANK, set[bank], clr[bank]);
+		else if(clr[bank])
+			reg_clr(PINCTRL_DOUT + bank * PINCTRL_BANK, clr[bank]);
+		else if(set[bank])
+			reg_set(PINCTRL_DOUT + bank * PINCTRL_BANK, set[bank]);
+	}
+	return 0;
+}
+
+const struct gpio_backend gpio_mmap_backend = {
+	.name = "mmap",
+	.pin_mode = mm_pin_mode,
+	.read = mm_read,
+	.write = mm_write,
+	.read_mask = mm_read_mask,
+	.write_mask = mm_write_mask,
+	.close = mm_close,
+};
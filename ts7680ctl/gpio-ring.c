@@ -0,0 +1,87 @@
+/********************************************************************************/
+// gpio-ring.c
+//	Lock-free timestamped edge event ring
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpio-ring.h"
+
+int gpio_ring_init(struct gpio_edge_ring *r, unsigned size)
+{
+	unsigned n = 2;
+
+	while(n < size)
+		n <<= 1;
+	memset(r, 0, sizeof(*r));
+	r->buf = calloc(n, sizeof(*r->buf));
+	if(!r->buf)
+		return -1;
+	r->mask = n - 1;
+	return 0;
+}
+
+void gpio_ring_free(struct gpio_edge_ring *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+uint64_t gpio_ring_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int gpio_ring_push(struct gpio_edge_ring *r, int gpio, int value, uint64_t ns)
+{
+	uint32_t head = r->head;
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	struct gpio_edge *e;
+
+	r->seq++;
+	if(head - tail > r->mask) {
+		__atomic_store_n(&r->overflows, r->overflows + 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	e = &r->buf[head & r->mask];
+	e->ns = ns;
+	e->seq = r->seq;
+	e->gpio = gpio;
+	e->value = value;
+	// Publish the record only after it is completely written
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+unsigned gpio_ring_drain(struct gpio_edge_ring *r, struct gpio_edge *out,
+  unsigned max)
+{
+	uint32_t tail = r->tail;
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	unsigned n = 0;
+
+	while(tail != head && n < max)
+		out[n++] = r->buf[tail++ & r->mask];
+	// Hand the slots back to the producer after copying them out
+	__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	return n;
+}
+
+unsigned gpio_ring_count(struct gpio_edge_ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+	  __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+uint32_t gpio_ring_overflows(struct gpio_edge_ring *r)
+{
+	return __atomic_load_n(&r->overflows, __ATOMIC_RELAXED);
+}
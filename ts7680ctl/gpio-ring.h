@@ -0,0 +1,39 @@
+#ifndef _GPIO_RING_H_
+#define _GPIO_RING_H_
+
+#include <stdint.h>
+
+// Timestamped edge record.  seq counts every edge seen by the producer,
+// including dropped ones, so a gap in seq shows where records were lost.
+struct gpio_edge {
+	uint64_t ns;		// CLOCK_MONOTONIC
+	uint32_t seq;
+	int16_t gpio;
+	uint8_t value;
+	uint8_t pad;
+};
+
+// Single-producer/single-consumer ring, preallocated, no locks.  One thread
+// may push and one other thread may drain at the same time.
+struct gpio_edge_ring {
+	struct gpio_edge *buf;
+	uint32_t mask;			// size - 1, size is a power of two
+	uint32_t head;			// written by the producer only
+	uint32_t tail;			// written by the consumer only
+	uint32_t seq;			// producer only
+	uint32_t overflows;		// producer only, read with gpio_ring_overflows()
+};
+
+// size is rounded up to a power of two
+int gpio_ring_init(struct gpio_edge_ring *r, unsigned size);
+void gpio_ring_free(struct gpio_edge_ring *r);
+// Producer side; returns -1 and counts an overflow when the ring is full
+int gpio_ring_push(struct gpio_edge_ring *r, int gpio, int value, uint64_t ns);
+// Consumer side; copies out up to max records and returns how many
+unsigned gpio_ring_drain(struct gpio_edge_ring *r, struct gpio_edge *out,
+  unsigned max);
+unsigned gpio_ring_count(struct gpio_edge_ring *r);
+uint32_t gpio_ring_overflows(struct gpio_edge_ring *r);
+uint64_t gpio_ring_now(void);
+
+#endif //_GPIO_RING_H_
@@ -0,0 +1,621 @@
+/********************************************************************************/
+// gpio.c
+//	sysfs GPIO access for the TS-7680
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+
+#include "gpiolib.h"
+
+/********************************************************************************/
+// Persistent value handles
+/********************************************************************************/
+
+static char gpio_root[64] = "/sys/class/gpio";
+
+// fd of each pin's open value file, or -1.  Opened on first access and kept
+// until the pin is unexported so reads and writes cost a single syscall.
+static int gpio_fds[GPIO_MAX_PINS];
+static int gpio_fds_init = 0;
+
+// Per-pin export registry flags, see gpio_claim()
+static unsigned char gpio_reg[GPIO_MAX_PINS];
+
+// Last direction, edge mode and driven value we know the kernel holds for
+// each pin, so repeated pinMode()/gpio_setedge()/digitalWrite() calls that
+// change nothing never reach sysfs.  GPIO_SHADOW_UNKNOWN forces a write.
+#define GPIO_SHADOW_UNKNOWN	-1
+#define GPIO_EDGE_NONE		0
+#define GPIO_EDGE_RISING	1
+#define GPIO_EDGE_FALLING	2
+#define GPIO_EDGE_BOTH		3
+
+struct gpio_shadow {
+	signed char dir;
+	signed char edge;
+	signed char value;
+};
+
+static struct gpio_shadow gpio_shadow[GPIO_MAX_PINS];
+
+static void gpio_forget(int gpio)
+{
+	gpio_shadow[gpio].dir = GPIO_SHADOW_UNKNOWN;
+	gpio_shadow[gpio].edge = GPIO_SHADOW_UNKNOWN;
+	gpio_shadow[gpio].value = GPIO_SHADOW_UNKNOWN;
+}
+
+static void gpio_fds_setup(void)
+{
+	int i;
+
+	if(gpio_fds_init)
+		return;
+	for(i = 0; i < GPIO_MAX_PINS; i++) {
+		gpio_fds[i] = -1;
+		gpio_forget(i);
+	}
+	gpio_fds_init = 1;
+}
+
+void gpio_set_sysfs_root(const char *path)
+{
+	int i;
+
+	gpio_close_all();
+	memset(gpio_reg, 0, sizeof(gpio_reg));
+	for(i = 0; i < GPIO_MAX_PINS; i++)
+		gpio_forget(i);
+	snprintf(gpio_root, sizeof(gpio_root), "%s", path ? path : "/sys/class/gpio");
+}
+
+const char *gpio_sysfs_root(void)
+{
+	return gpio_root;
+}
+
+int gpio_open(int gpio)
+{
+	char buf[96];
+	int fd;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	gpio_fds_setup();
+	if(gpio_fds[gpio] != -1)
+		return gpio_fds[gpio];
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/value", gpio_root, gpio);
+	fd = open(buf, O_RDWR | O_CLOEXEC);
+	if(fd < 0) {
+		// Inputs owned by another user may only be readable
+		fd = open(buf, O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			return -1;
+	}
+
+	gpio_fds[gpio] = fd;
+	return fd;
+}
+
+void gpio_close(int gpio)
+{
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS || !gpio_fds_init)
+		return;
+	if(gpio_fds[gpio] != -1) {
+		close(gpio_fds[gpio]);
+		gpio_fds[gpio] = -1;
+	}
+}
+
+void gpio_close_all(void)
+{
+	int i;
+
+	if(!gpio_fds_init)
+		return;
+	for(i = 0; i < GPIO_MAX_PINS; i++)
+		gpio_close(i);
+}
+
+/********************************************************************************/
+// Export registry
+/********************************************************************************/
+
+#define GPIO_REG_EXPORTED	0x1	// gpioN directory known to exist
+#define GPIO_REG_OWNED		0x2	// we wrote it to export, so we may unexport
+#define GPIO_REG_PINNED		0x4	// from a manifest, never released
+
+static int gpio_policy = GPIO_EXPORT_RELEASE;
+
+static const struct gpio_backend gpio_sysfs_backend;
+static const struct gpio_backend *gpio_be;
+
+void gpio_set_export_policy(int policy)
+{
+	gpio_policy = policy;
+}
+
+int gpio_get_export_policy(void)
+{
+	return gpio_policy;
+}
+
+int gpio_is_exported(int gpio)
+{
+	char buf[96];
+	struct stat st;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return 0;
+	if(gpio_reg[gpio] & GPIO_REG_EXPORTED)
+		return 1;
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d", gpio_root, gpio);
+	if(stat(buf, &st) == 0 && S_ISDIR(st.st_mode)) {
+		gpio_reg[gpio] |= GPIO_REG_EXPORTED;
+		return 1;
+	}
+	return 0;
+}
+
+int gpio_claim(int gpio)
+{
+	int ret;
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	// Character device lines are requested by the backend itself, and an
+	// exported line would be busy for it
+	if(gpio_be != &gpio_sysfs_backend)
+		return 0;
+	if(gpio_is_exported(gpio))
+		return 0;
+
+	ret = gpio_export(gpio);
+	if(ret)
+		return ret;
+	gpio_reg[gpio] |= GPIO_REG_EXPORTED | GPIO_REG_OWNED;
+	return 1;
+}
+
+void gpio_release(int gpio)
+{
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return;
+	// Leave pins alone that another process exported or that we were
+	// told to keep; tearing them down races with their other users.
+	if(gpio_policy == GPIO_EXPORT_KEEP || gpio_be != &gpio_sysfs_backend)
+		return;
+	if((gpio_reg[gpio] & (GPIO_REG_OWNED | GPIO_REG_PINNED)) != GPIO_REG_OWNED)
+		return;
+	gpio_unexport(gpio);
+}
+
+int gpio_load_manifest(const char *path)
+{
+	FILE *f;
+	char line[128], mode[16];
+	int gpio, n, err, lineno = 0, count = 0, ret = 0;
+
+	f = fopen(path, "r");
+	if(!f) {
+		perror(path);
+		return -1;
+	}
+
+	// One pin per line: "<gpio> [in|out|high|low]", '#' starts a comment
+	while(fgets(line, sizeof(line), f)) {
+		lineno++;
+		if(strchr(line, '#'))
+			*strchr(line, '#') = 0;
+		mode[0] = 0;
+		n = sscanf(line, "%d %15s", &gpio, mode);
+		if(n < 1)
+			continue;
+		if(gpio < 0 || gpio >= GPIO_MAX_PINS || gpio_claim(gpio) < 0) {
+			fprintf(stderr, "%s:%d: can't export gpio %d\n", path, lineno, gpio);
+			ret = -1;
+			continue;
+		}
+		gpio_reg[gpio] |= GPIO_REG_PINNED;
+		count++;
+
+		if(n < 2)
+			continue;
+		if(!strcmp(mode, "in")) {
+			err = pinMode(gpio, 0);
+		} else if(!strcmp(mode, "out")) {
+			err = pinMode(gpio, 1);
+		} else if(!strcmp(mode, "high") || !strcmp(mode, "low")) {
+			err = pinMode(gpio, 1);
+			if(!err)
+				err = digitalWrite(gpio, mode[0] == 'h');
+		} else {
+			fprintf(stderr, "%s:%d: unknown mode '%s'\n", path, lineno, mode);
+			err = -1;
+		}
+		if(err)
+			ret = -1;
+	}
+
+	fclose(f);
+	return ret ? ret : count;
+}
+
+/********************************************************************************/
+// Digital IO and two Relays Setup
+/********************************************************************************/
+
+static int sysfs_pin_mode(int gpio, int dir)
+{
+	int ret = 0;
+	char buf[96];
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	gpio_fds_setup();
+	if(gpio_shadow[gpio].dir == !!dir)
+		return 0;
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/direction", gpio_root, gpio);
+	int gpiofd = open(buf, O_WRONLY);
+	if(gpiofd < 0) {
+		perror("Couldn't open IRQ file");
+		return -1;
+	}
+
+	if(dir == 1) {
+		if (3 != write(gpiofd, "out", 3)) {
+			perror("Couldn't set GPIO direction to out");
+			ret = -2;
+		}
+	}
+	else {
+		if(2 != write(gpiofd, "in", 2)) {
+			perror("Couldn't set GPIO directio to in");
+			ret = -3;
+		}
+	}
+
+	close(gpiofd);
+	// "out" drives the pin low
+	gpio_shadow[gpio].dir = ret ? GPIO_SHADOW_UNKNOWN : !!dir;
+	gpio_shadow[gpio].value = ret || !dir ? GPIO_SHADOW_UNKNOWN : 0;
+	return ret;
+}
+
+int gpio_setedge(int gpio, int rising, int falling)
+{
+	int ret = 0;
+	char buf[96];
+	int edge = (rising ? GPIO_EDGE_RISING : 0) | (falling ? GPIO_EDGE_FALLING : 0);
+
+	if(gpio < 0 || gpio >= GPIO_MAX_PINS)
+		return -1;
+	gpio_fds_setup();
+	if(!edge || gpio_shadow[gpio].edge == edge)
+		return 0;
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/edge", gpio_root, gpio);
+	int gpiofd = open(buf, O_WRONLY);
+	if(gpiofd < 0) {
+		perror("Couldn't open IRQ file");
+		return -1;
+	}
+
+	if(rising && falling) {
+		if(4 != write(gpiofd, "both", 4)) {
+			perror("Failed to set IRQ to both falling & rising");
+			ret = -2;
+		}
+	} else {
+		if(rising) {
+			if(6 != write(gpiofd, "rising", 6)) {
+				perror("Failed to set IRQ to rising");
+				ret = -2;
+			}
+		} else if(falling) {
+			if(7 != write(gpiofd, "falling", 7)) {
+				perror("Failed to set IRQ to falling");
+				ret = -3;
+			}
+		}
+	}
+
+	close(gpiofd);
+	gpio_shadow[gpio].edge = ret ? GPIO_SHADOW_UNKNOWN : edge;
+	return ret;
+}
+
+int gpio_select(int gpio)
+{
+	char gpio_irq[96];
+	int ret = 0, buf, irqfd;
+	fd_set fds;
+	FD_ZERO(&fds);
+
+	snprintf(gpio_irq, sizeof(gpio_irq), "%s/gpio%d/value", gpio_root, gpio);
+	irqfd = open(gpio_irq, O_RDONLY, S_IREAD);
+	if(irqfd < 1) {
+		perror("Couldn't open the value file");
+		return -1;
+	}
+
+	// Read first since there is always an initial status
+	read(irqfd, &buf, sizeof(buf));
+
+	while(1) {
+		FD_SET(irqfd, &fds);
+		ret = select(irqfd + 1, NULL, NULL, &fds, NULL);
+		if(ret > 0 && FD_ISSET(irqfd, &fds))
+		{
+			FD_CLR(irqfd, &fds);  //Remove the filedes from set
+			// Clear the junk data in the IRQ file
+			read(irqfd, &buf, sizeof(buf));
+			close(irqfd);
+			return 1;
+		}
+	}
+}
+
+int gpio_export(int gpio)
+{
+	int efd;
+	char buf[96];
+	int ret;
+
+	if(gpio >= 0 && gpio < GPIO_MAX_PINS && (gpio_reg[gpio] & GPIO_REG_EXPORTED))
+		return 0;
+	snprintf(buf, sizeof(buf), "%s/export", gpio_root);
+	efd = open(buf, O_WRONLY);
+
+	if(efd != -1) {
+		sprintf(buf, "%d", gpio);
+		ret = write(efd, buf, strlen(buf));
+		close(efd);
+		if(ret < 0) {
+			perror("Export failed");
+			return -2;
+		}
+	} else {
+		// If we can't open the export file, we probably
+		// don't have any gpio permissions
+		return -1;
+	}
+	return 0;
+}
+
+void gpio_unexport(int gpio)
+{
+	int gpiofd;
+	char buf[96];
+
+	// The value file goes away with the gpioN directory
+	gpio_close(gpio);
+	if(gpio >= 0 && gpio < GPIO_MAX_PINS) {
+		gpio_reg[gpio] = 0;
+		if(gpio_fds_init)
+			gpio_forget(gpio);
+	}
+
+	snprintf(buf, sizeof(buf), "%s/unexport", gpio_root);
+	gpiofd = open(buf, O_WRONLY);
+	if(gpiofd < 0)
+		return;
+	sprintf(buf, "%d", gpio);
+	write(gpiofd, buf, strlen(buf));
+	close(gpiofd);
+}
+
+static int sysfs_read(int gpio)
+{
+	char in[2] = {0, 0};
+	int nread, gpiofd;
+
+	gpiofd = gpio_open(gpio);
+	if(gpiofd < 0) {
+		fprintf(stderr, "Failed to open gpio %d value\n", gpio);
+		perror("gpio failed");
+		return -1;
+	}
+
+	// sysfs regenerates the attribute on every read at offset 0
+	nread = pread(gpiofd, in, 1, 0);
+	if(nread != 1) {
+		perror("GPIO Read Failed");
+		return -1;
+	}
+
+	return in[0] == '1';
+}
+
+static int sysfs_write(int gpio, int val)
+{
+	int gpiofd;
+
+	gpiofd = gpio_open(gpio);
+	if(gpiofd < 0)
+		return 1;
+	val = !!val;
+	if(gpio_shadow[gpio].value == val)
+		return 0;
+
+	if(pwrite(gpiofd, val ? "1" : "0", 1, 0) != 1) {
+		perror("failed to set gpio");
+		gpio_shadow[gpio].value = GPIO_SHADOW_UNKNOWN;
+		return 1;
+	}
+	gpio_shadow[gpio].value = val;
+	return 0;
+}
+
+// Read one attribute file of a pin into buf, "" on failure
+static void sysfs_attr(int gpio, const char *attr, char *buf, int len)
+{
+	char path[96];
+	int fd, n;
+
+	buf[0] = 0;
+	snprintf(path, sizeof(path), "%s/gpio%d/%s", gpio_root, gpio, attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	buf[n > 0 ? n : 0] = 0;
+}
+
+static void sysfs_resync(int gpio)
+{
+	struct gpio_shadow *sh = &gpio_shadow[gpio];
+	char buf[16];
+
+	gpio_forget(gpio);
+	sysfs_attr(gpio, "direction", buf, sizeof(buf));
+	if(!strncmp(buf, "out", 3))
+		sh->dir = 1;
+	else if(!strncmp(buf, "in", 2))
+		sh->dir = 0;
+
+	sysfs_attr(gpio, "edge", buf, sizeof(buf));
+	if(!strncmp(buf, "none", 4))
+		sh->edge = GPIO_EDGE_NONE;
+	else if(!strncmp(buf, "rising", 6))
+		sh->edge = GPIO_EDGE_RISING;
+	else if(!strncmp(buf, "falling", 7))
+		sh->edge = GPIO_EDGE_FALLING;
+	else if(!strncmp(buf, "both", 4))
+		sh->edge = GPIO_EDGE_BOTH;
+
+	// Only an output has a driven value worth remembering
+	if(sh->dir == 1) {
+		sysfs_attr(gpio, "value", buf, sizeof(buf));
+		if(buf[0] == '0' || buf[0] == '1')
+			sh->value = buf[0] == '1';
+	}
+}
+
+int gpio_resync(int gpio)
+{
+	struct gpio_shadow *sh;
+	int i;
+
+	gpio_fds_setup();
+	if(gpio >= GPIO_MAX_PINS)
+		return -1;
+	if(gpio >= 0) {
+		sysfs_resync(gpio);
+		return 0;
+	}
+	for(i = 0; i < GPIO_MAX_PINS; i++) {
+		sh = &gpio_shadow[i];
+		if(sh->dir != GPIO_SHADOW_UNKNOWN || sh->edge != GPIO_SHADOW_UNKNOWN ||
+		  sh->value != GPIO_SHADOW_UNKNOWN)
+			sysfs_resync(i);
+	}
+	return 0;
+}
+
+/********************************************************************************/
+// Backend selection
+/********************************************************************************/
+
+static const struct gpio_backend gpio_sysfs_backend = {
+	.name = "sysfs",
+	.pin_mode = sysfs_pin_mode,
+	.read = sysfs_read,
+	.write = sysfs_write,
+	.close = gpio_close_all,
+};
+
+static const struct gpio_backend *gpio_backends[] = {
+	&gpio_sysfs_backend,
+	&gpio_cdev_backend,
+	&gpio_mmap_backend,
+	NULL,
+};
+
+static const struct gpio_backend *gpio_be = &gpio_sysfs_backend;
+
+int gpio_set_backend(const char *name)
+{
+	int i;
+
+	for(i = 0; gpio_backends[i]; i++) {
+		if(strcmp(gpio_backends[i]->name, name))
+			continue;
+		if(gpio_be != gpio_backends[i] && gpio_be->close)
+			gpio_be->close();
+		gpio_be = gpio_backends[i];
+		return 0;
+	}
+	fprintf(stderr, "Unknown gpio backend '%s'\n", name);
+	return -1;
+}
+
+const char *gpio_get_backend(void)
+{
+	return gpio_be->name;
+}
+
+int pinMode(int gpio, int dir)
+{
+	return gpio_be->pin_mode(gpio, dir);
+}
+
+int digitalRead(int gpio)
+{
+	return gpio_be->read(gpio);
+}
+
+int digitalWrite(int gpio, int val)
+{
+	return gpio_be->write(gpio, val);
+}
+
+int digitalReadMask(const int *pins, int n, uint64_t *out)
+{
+	int i, v;
+
+	if(n < 0 || n > 64)
+		return -1;
+	if(gpio_be->read_mask)
+		return gpio_be->read_mask(pins, n, out);
+
+	*out = 0;
+	for(i = 0; i < n; i++) {
+		v = gpio_be->read(pins[i]);
+		if(v < 0)
+			return -1;
+		if(v)
+			*out |= 1ULL << i;
+	}
+	return 0;
+}
+
+int digitalWriteMask(const int *pins, int n, uint64_t mask, uint64_t values)
+{
+	int i, ret = 0;
+
+	if(n < 0 || n > 64)
+		return -1;
+	if(gpio_be->write_mask)
+		return gpio_be->write_mask(pins, n, mask, values);
+
+	for(i = 0; i < n; i++) {
+		if(!((mask >> i) & 1))
+			continue;
+		if(gpio_be->write(pins[i], (values >> i) & 1))
+			ret = -1;
+	}
+	return ret;
+}
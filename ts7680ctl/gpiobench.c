@@ -0,0 +1,384 @@
+/********************************************************************************/
+// gpiobench.c
+//	Compares GPIO access paths against a fake (or real) sysfs tree and
+//	gpiochip
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
+
+#include "gpiolib.h"
+#include "pwm.h"
+
+#define BENCH_PINS	16
+#define PWM_PERIOD_US	1000
+#define PWM_RUN_MS	500
+
+static const int pins[BENCH_PINS] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 32, 33, 34, 35, 64, 65, 96, 97
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void put_file(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+	if(!f) {
+		perror(path);
+		exit(1);
+	}
+	fputs(val, f);
+	fclose(f);
+}
+
+// Build <dir>/export, <dir>/unexport and gpioN/{value,direction,edge}
+static void make_fake_tree(const char *root)
+{
+	char buf[128];
+	int i;
+
+	snprintf(buf, sizeof(buf), "%s/export", root);
+	put_file(buf, "");
+	snprintf(buf, sizeof(buf), "%s/unexport", root);
+	put_file(buf, "");
+	for(i = 0; i < BENCH_PINS; i++) {
+		snprintf(buf, sizeof(buf), "%s/gpio%d", root, pins[i]);
+		mkdir(buf, 0755);
+		snprintf(buf, sizeof(buf), "%s/gpio%d/value", root, pins[i]);
+		put_file(buf, "0\n");
+		snprintf(buf, sizeof(buf), "%s/gpio%d/direction", root, pins[i]);
+		put_file(buf, "in\n");
+		snprintf(buf, sizeof(buf), "%s/gpio%d/edge", root, pins[i]);
+		put_file(buf, "none\n");
+	}
+}
+
+static void remove_fake_tree(const char *root)
+{
+	char buf[160];
+	snprintf(buf, sizeof(buf), "rm -rf '%s'", root);
+	system(buf);
+}
+
+/********************************************************************************/
+// In-process fake gpiochip for the cdev backend
+/********************************************************************************/
+
+#define FAKE_CHIP_FD	1000
+#define FAKE_REQ_FD	2000
+#define FAKE_REQS	32
+
+struct fake_req {
+	int used;
+	int chip;
+	int nlines;
+	unsigned offsets[GPIO_V2_LINES_MAX];
+};
+
+static uint32_t fake_lines[GPIO_MAX_PINS / 32];
+static struct fake_req fake_reqs[FAKE_REQS];
+
+static int fake_open(const char *path, int flags)
+{
+	int chip;
+	(void)flags;
+	if(sscanf(path, "/dev/gpiochip%d", &chip) != 1)
+		return -1;
+	return FAKE_CHIP_FD + chip;
+}
+
+static int fake_close(int fd)
+{
+	if(fd >= FAKE_REQ_FD && fd < FAKE_REQ_FD + FAKE_REQS)
+		fake_reqs[fd - FAKE_REQ_FD].used = 0;
+	return 0;
+}
+
+static int fake_ioctl(int fd, unsigned long req, void *arg)
+{
+	struct gpio_v2_line_request *lr = arg;
+	struct gpio_v2_line_values *v = arg;
+	struct fake_req *r;
+	int i;
+
+	// Stand in for the cost of entering the kernel once per ioctl
+	getppid();
+
+	if(req == GPIO_V2_GET_LINE_IOCTL) {
+		for(i = 0; i < FAKE_REQS && fake_reqs[i].used; i++)
+			;
+		if(i == FAKE_REQS)
+			return -1;
+		r = &fake_reqs[i];
+		r->used = 1;
+		r->chip = fd - FAKE_CHIP_FD;
+		r->nlines = lr->num_lines;
+		memcpy(r->offsets, lr->offsets, sizeof(r->offsets));
+		lr->fd = FAKE_REQ_FD + i;
+		return 0;
+	}
+
+	r = &fake_reqs[fd - FAKE_REQ_FD];
+	if(req == GPIO_V2_LINE_GET_VALUES_IOCTL) {
+		v->bits = 0;
+		for(i = 0; i < r->nlines; i++) {
+			if(((v->mask >> i) & 1) && (fake_lines[r->chip] >> r->offsets[i]) & 1)
+				v->bits |= 1ULL << i;
+		}
+		return 0;
+	}
+	if(req == GPIO_V2_LINE_SET_VALUES_IOCTL) {
+		for(i = 0; i < r->nlines; i++) {
+			if(!((v->mask >> i) & 1))
+				continue;
+			if((v->bits >> i) & 1)
+				fake_lines[r->chip] |= 1U << r->offsets[i];
+			else
+				fake_lines[r->chip] &= ~(1U << r->offsets[i]);
+		}
+		return 0;
+	}
+	if(req == GPIO_V2_LINE_SET_CONFIG_IOCTL)
+		return 0;
+	return -1;
+}
+
+static const struct gpio_cdev_ops fake_chip_ops = {
+	.open = fake_open,
+	.close = fake_close,
+	.ioctl = fake_ioctl,
+};
+
+// The pre-handle access paths: open, one byte of I/O, close
+static int legacy_read(int gpio)
+{
+	char in[3] = {0, 0, 0};
+	char buf[96];
+	int fd;
+	sprintf(buf, "%s/gpio%d/value", gpio_sysfs_root(), gpio);
+	fd = open(buf, O_RDWR);
+	if(fd < 0)
+		return -1;
+	read(fd, in, 1);
+	close(fd);
+	return atoi(in);
+}
+
+static int legacy_write(int gpio, int val)
+{
+	char buf[96];
+	int fd, ret;
+	sprintf(buf, "%s/gpio%d/value", gpio_sysfs_root(), gpio);
+	fd = open(buf, O_RDWR);
+	if(fd < 0)
+		return 1;
+	snprintf(buf, 2, "%d", val);
+	ret = write(fd, buf, 2);
+	close(fd);
+	return ret != 2;
+}
+
+static void report(const char *name, double t0, double t1, long ops)
+{
+	printf("%-24s %10ld ops %10.1f ns/op %12.0f ops/s\n", name, ops,
+	  (t1 - t0) / ops, ops / ((t1 - t0) / 1e9));
+}
+
+// Software PWM on nch pins of the current backend, each at PWM_PERIOD_US
+// with a different duty; prints what the platform actually sustained
+static int bench_pwm(int nch)
+{
+	struct pwm_stats st;
+	struct pwm *pwm;
+	int i;
+
+	pwm = pwm_new();
+	if(!pwm)
+		return 1;
+	for(i = 0; i < nch; i++) {
+		if(pwm_set(pwm, pins[i], PWM_PERIOD_US,
+		  PWM_PERIOD_US * (i + 1) / (nch + 1))) {
+			pwm_free(pwm);
+			return 1;
+		}
+	}
+	if(pwm_start(pwm)) {
+		pwm_free(pwm);
+		return 1;
+	}
+	usleep(PWM_RUN_MS * 1000);
+	pwm_get_stats(pwm, &st);
+	pwm_free(pwm);
+
+	printf("pwm %d ch at %d Hz      %10lu edges %10lu writes %10lu wakeups\n",
+	  nch, 1000000 / PWM_PERIOD_US, st.edges, st.writes, st.wakeups);
+	for(i = 0; i < st.nchannels; i++)
+		printf("  gpio%-3d %10lu cycles %12.3f Hz achieved\n", st.ch[i].gpio,
+		  st.ch[i].cycles, st.ch[i].freq_hz);
+	printf("  late min/avg/max %8.1f %8.1f %8.1f us\n",
+	  st.late_min_ns / 1e3, st.late_avg_ns / 1e3, st.late_max_ns / 1e3);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long iters = 20000, n;
+	char tmpl[] = "/tmp/gpiobench.XXXXXX";
+	char *root = NULL;
+	char path[96];
+	int c, i, fake = 1, nch = 4, ret = 0;
+	double t0, t1;
+	uint64_t bits;
+
+	while((c = getopt(argc, argv, "n:r:p:h")) != -1) {
+		switch(c) {
+		case 'n':
+			iters = atol(optarg);
+			break;
+		case 'r':
+			root = optarg;
+			fake = 0;
+			break;
+		case 'p':
+			nch = atoi(optarg);
+			if(nch < 0 || nch > BENCH_PINS)
+				nch = BENCH_PINS;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-r sysfs-gpio-root] "
+			  "[-p pwm-channels]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(fake) {
+		root = mkdtemp(tmpl);
+		if(!root) {
+			perror("mkdtemp");
+			return 1;
+		}
+		make_fake_tree(root);
+	}
+	gpio_set_sysfs_root(root);
+	printf("gpio tree: %s (%d pins, %ld iterations)\n", root, BENCH_PINS, iters);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			legacy_read(pins[i]);
+	t1 = now_ns();
+	report("read  open/read/close", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			digitalRead(pins[i]);
+	t1 = now_ns();
+	report("read  handle/pread", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			legacy_write(pins[i], n & 1);
+	t1 = now_ns();
+	report("write open/write/close", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			digitalWrite(pins[i], n & 1);
+	t1 = now_ns();
+	report("write handle/pwrite", t0, t1, iters * BENCH_PINS);
+
+	gpio_set_backend("cdev");
+	if(fake)
+		gpio_cdev_set_ops(&fake_chip_ops);
+	gpio_cdev_request(pins, BENCH_PINS, 1);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			digitalRead(pins[i]);
+	t1 = now_ns();
+	report("read  cdev ioctl", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			digitalWrite(pins[i], n & 1);
+	t1 = now_ns();
+	report("write cdev ioctl", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		digitalReadMask(pins, BENCH_PINS, &bits);
+	t1 = now_ns();
+	report("read  cdev mask (pins)", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		digitalWriteMask(pins, BENCH_PINS, ~0ULL, n & 1 ? ~0ULL : 0);
+	t1 = now_ns();
+	report("write cdev mask (pins)", t0, t1, iters * BENCH_PINS);
+
+	// PINCTRL registers, from a plain file unless running on the board
+	if(fake) {
+		snprintf(path, sizeof(path), "%s/pinctrl", root);
+		put_file(path, "");
+		gpio_mmap_set_window(path, 0);
+	}
+	gpio_set_backend("mmap");
+	for(i = 0; i < BENCH_PINS; i++)
+		pinMode(pins[i], 1);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			digitalRead(pins[i]);
+	t1 = now_ns();
+	report("read  mmap register", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_PINS; i++)
+			digitalWrite(pins[i], n & 1);
+	t1 = now_ns();
+	report("write mmap register", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		digitalReadMask(pins, BENCH_PINS, &bits);
+	t1 = now_ns();
+	report("read  mmap mask (pins)", t0, t1, iters * BENCH_PINS);
+
+	t0 = now_ns();
+	for(n = 0; n < iters; n++)
+		digitalWriteMask(pins, BENCH_PINS, ~0ULL, n & 1 ? ~0ULL : 0);
+	t1 = now_ns();
+	report("write mmap mask (pins)", t0, t1, iters * BENCH_PINS);
+
+	if(nch)
+		ret = bench_pwm(nch);
+
+	gpio_set_backend("sysfs");
+	gpio_mmap_set_window(NULL, 0);
+	gpio_close_all();
+	if(fake)
+		remove_fake_tree(root);
+	return ret;
+}
@@ -1,16 +1,112 @@
 #ifndef _GPIOLIB_H_
+#define _GPIOLIB_H_
 
-// returns -1 or the file descriptor of the gpio value file
+#include <stdint.h>
+
+// Highest sysfs gpio number + 1 tracked by the handle table
+#define GPIO_MAX_PINS 256
+
+// returns -1 or the file descriptor of the gpio value file.  The fd is
+// cached and reused until gpio_close()/gpio_unexport(); don't close it.
 int gpio_open(int gpio);
+void gpio_close(int gpio);
+void gpio_close_all(void);
+// Point the library at a different sysfs gpio tree (NULL restores default)
+void gpio_set_sysfs_root(const char *path);
+const char *gpio_sysfs_root(void);
+// Export registry.  gpio_claim() exports a pin only if its gpioN directory
+// doesn't exist yet; gpio_release() unexports it again only if we exported
+// it and the policy is GPIO_EXPORT_RELEASE.  gpio_claim() returns 1 if it
+// exported the pin, 0 if it was already exported or the backend doesn't
+// use sysfs, negative on failure; the top-level gpiolib.c does the same.
+#define GPIO_EXPORT_RELEASE	0
+#define GPIO_EXPORT_KEEP	1
+void gpio_set_export_policy(int policy);
+int gpio_get_export_policy(void);
+int gpio_is_exported(int gpio);
+int gpio_claim(int gpio);
+void gpio_release(int gpio);
+// The sysfs backend remembers each pin's direction, edge mode and driven
+// value and skips writes that wouldn't change them.  If something else may
+// have touched a pin, gpio_resync() re-reads its state from sysfs; -1
+// re-reads every pin the library has state for.
+int gpio_resync(int gpio);
+// Exports every pin listed in a manifest and keeps it exported; returns the
+// number of pins set up or -1 if any line failed
+int gpio_load_manifest(const char *path);
+// Access method behind pinMode()/digitalRead()/digitalWrite().  "sysfs"
+// (default) uses /sys/class/gpio, "cdev" uses /dev/gpiochipN line requests,
+// "mmap" drives the i.MX28 PINCTRL registers directly.
+struct gpio_backend {
+	const char *name;
+	int (*pin_mode)(int gpio, int dir);
+	int (*read)(int gpio);
+	int (*write)(int gpio, int val);
+	// Optional; bit i of the masks is pins[i].  NULL falls back to per-pin
+	int (*read_mask)(const int *pins, int n, uint64_t *out);
+	int (*write_mask)(const int *pins, int n, uint64_t mask, uint64_t values);
+	void (*close)(void);
+};
+extern const struct gpio_backend gpio_cdev_backend;
+extern const struct gpio_backend gpio_mmap_backend;
+int gpio_set_backend(const char *name);
+const char *gpio_get_backend(void);
+
+// Character device backend.  gpio N is line N%32 of /dev/gpiochip(N/32).
+// Each chip has one line request holding every line used on it, so a group
+// on one chip is read or written with a single ioctl.  A line touched for
+// the first time grows the request (released and requested again, outputs
+// keeping their levels); gpio_cdev_request() adds a whole group up front
+// in one go.  Listing a pin twice is an error.
+struct gpio_cdev_ops {
+	int (*open)(const char *path, int flags);
+	int (*close)(int fd);
+	int (*ioctl)(int fd, unsigned long req, void *arg);
+};
+int gpio_cdev_request(const int *pins, int n, int dir);
+// Replace open/close/ioctl, e.g. with an in-process fake chip; NULL restores
+void gpio_cdev_set_ops(const struct gpio_cdev_ops *ops);
+// Edge detection on one input line, in a request of its own.  The kernel
+// timestamps each edge and queues it on the returned fd (close() it when
+// done); *value gets the level at the time of the request.  Fails with
+// EBUSY if the pin is in use through the backend or exported in sysfs.
+struct gpio_cdev_edge {
+	uint64_t ns;			// CLOCK_MONOTONIC
+	uint32_t seq;			// edges detected on the line so far,
+					// including any the queue overflowed
+	int value;			// level after the edge
+};
+int gpio_cdev_request_edges(int gpio, int rising, int falling, int *value);
+// Reads up to max queued edges, blocking until there is one; count or -1
+int gpio_cdev_read_edges(int fd, struct gpio_cdev_edge *out, int max);
+int gpio_cdev_edge_level(int fd);
+
+// PINCTRL register backend.  Reads DIN directly and writes through the
+// DOUT SET/CLR aliases, so digitalWriteMask() updates each bank at once.
+// A bank with pins going both high and low is written with one
+// read-modify-write of DOUT instead.  That avoids the glitch, but a
+// concurrent write to the same bank from outside this process can be lost.
+// The window comes from /dev/mem by default; a plain file can stand in for
+// it (SET/CLR are then emulated).  NULL restores /dev/mem.
+#define GPIO_MMAP_PINCTRL_BASE	0x80018000
+int gpio_mmap_set_window(const char *path, long offset);
+
 // 1 output, 0 input
 int pinMode(int gpio, int dir);
 int gpio_export(int gpio);
 void gpio_unexport(int gpio);
 int digitalRead(int gpio);
 int digitalWrite(int gpio, int val);
+// Read or write up to 64 pins at once.  Bit i of out/mask/values is pins[i];
+// digitalWriteMask() only touches pins whose mask bit is set.  Backends
+// group the pins by bank so a cdev read is one coherent snapshot per chip.
+int digitalReadMask(const int *pins, int n, uint64_t *out);
+int digitalWriteMask(const int *pins, int n, uint64_t mask, uint64_t values);
 int gpio_setedge(int gpio, int rising, int falling);
+// Blocks until one edge on one pin; see gpio-event.h for watching several
 int gpio_select(int gpio);
 int dac(int dacpin, int value);
+// mode is ADC_MODE_MV or ADC_MODE_MA from adc.h
 int analogInMode(int adcpin, int mode);
 int ts7680Setup(void);
 #endif //_GPIOLIB_H_
@@ -0,0 +1,249 @@
+/********************************************************************************/
+// i2c-sched.c
+//	FPGA I2C transaction scheduler: one bus owner thread, many submitters
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "fpga.h"
+#include "i2c-sched.h"
+
+struct i2c_sched {
+	struct fpga_dev *dev;
+	int wakefd;
+	pthread_t thread;
+	int running;
+	// Submitted requests, newest first.  Producers push with a CAS; the
+	// scheduler takes the whole stack at once, so there is no ABA.
+	struct i2c_req *head;
+	// Scheduler thread only: accepted requests by priority, then age
+	struct i2c_req *pending;
+	unsigned long seq;
+	// Completion
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct i2c_sched_stats st;
+};
+
+void i2c_sched_submit(struct i2c_sched *s, struct i2c_req *req)
+{
+	struct i2c_req *old = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+	uint64_t one = 1;
+
+	req->done = 0;
+	req->status = 0;
+	do {
+		req->next = old;
+	} while(!__atomic_compare_exchange_n(&s->head, &old, req, 1,
+	  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	// Only the push onto an empty stack needs to wake the scheduler
+	if(!old)
+		write(s->wakefd, &one, sizeof(one));
+}
+
+// Move everything submitted so far into the pending list
+static void intake(struct i2c_sched *s)
+{
+	struct i2c_req *list, *rev = NULL, *next, **pp;
+
+	list = __atomic_exchange_n(&s->head, NULL, __ATOMIC_ACQUIRE);
+	for(; list; list = next) {
+		next = list->next;
+		list->next = rev;
+		rev = list;
+	}
+
+	for(; rev; rev = next) {
+		next = rev->next;
+		rev->seq = s->seq++;
+		for(pp = &s->pending; *pp && (*pp)->prio >= rev->prio; pp = &(*pp)->next)
+			;
+		rev->next = *pp;
+		*pp = rev;
+	}
+}
+
+static void complete(struct i2c_sched *s, struct i2c_req *first, int n, int status)
+{
+	struct i2c_req *r, *next;
+	int i;
+
+	for(i = 0, r = first; i < n; i++, r = next) {
+		next = r->next;
+		r->status = status;
+		if(r->cb)
+			r->cb(r, r->arg);
+		// The waiter may free r as soon as done is set
+		pthread_mutex_lock(&s->lock);
+		__atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->st.requests += n;
+	s->st.transactions++;
+	if(n > 1)
+		s->st.merged += n;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+// Serve the head of the pending list together with the requests right
+// behind it that continue its address range
+static void serve_one(struct i2c_sched *s)
+{
+	uint8_t buf[FPGA_MAX_BURST];
+	struct i2c_req *first = s->pending, *r;
+	int n = 1, total = first->len, status, off;
+
+	for(r = first->next; r; r = r->next, n++) {
+		if(r->write != first->write || r->prio != first->prio ||
+		  r->addr != first->addr + total || total + r->len > FPGA_MAX_BURST)
+			break;
+		total += r->len;
+	}
+	s->pending = r;
+
+	if(total <= 0 || total > FPGA_MAX_BURST) {
+		complete(s, first, n, -1);
+		return;
+	}
+
+	if(first->write) {
+		for(r = first, off = 0; off < total; off += r->len, r = r->next)
+			memcpy(buf + off, r->buf, r->len);
+		status = fpga_pokeN(s->dev, first->addr, buf, total);
+	} else {
+		status = fpga_peekN(s->dev, first->addr, buf, total);
+		if(!status) {
+			for(r = first, off = 0; off < total; off += r->len, r = r->next)
+				memcpy(r->buf, buf + off, r->len);
+		}
+	}
+	complete(s, first, n, status);
+}
+
+static void *sched_thread(void *arg)
+{
+	struct i2c_sched *s = arg;
+	struct pollfd pfd;
+	uint64_t cnt;
+
+	pfd.fd = s->wakefd;
+	pfd.events = POLLIN;
+	for(;;) {
+		// Take new arrivals before every transaction so a high
+		// priority request overtakes whatever is still queued
+		intake(s);
+		if(s->pending) {
+			serve_one(s);
+			continue;
+		}
+		if(!__atomic_load_n(&s->running, __ATOMIC_ACQUIRE) &&
+		  !__atomic_load_n(&s->head, __ATOMIC_ACQUIRE))
+			break;
+		poll(&pfd, 1, -1);
+		read(s->wakefd, &cnt, sizeof(cnt));
+	}
+	return NULL;
+}
+
+struct i2c_sched *i2c_sched_new(struct fpga_dev *dev)
+{
+	struct i2c_sched *s;
+
+	s = calloc(1, sizeof(*s));
+	if(!s)
+		return NULL;
+	s->dev = dev;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(s->wakefd < 0) {
+		perror("Couldn't create I2C scheduler");
+		goto err;
+	}
+	s->running = 1;
+	if(pthread_create(&s->thread, NULL, sched_thread, s)) {
+		perror("Couldn't start I2C scheduler");
+		close(s->wakefd);
+		goto err;
+	}
+	return s;
+
+err:
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+	return NULL;
+}
+
+void i2c_sched_free(struct i2c_sched *s)
+{
+	uint64_t one = 1;
+
+	if(!s)
+		return;
+	__atomic_store_n(&s->running, 0, __ATOMIC_RELEASE);
+	write(s->wakefd, &one, sizeof(one));
+	pthread_join(s->thread, NULL);
+	close(s->wakefd);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
+
+int i2c_sched_wait(struct i2c_sched *s, struct i2c_req *req)
+{
+	pthread_mutex_lock(&s->lock);
+	while(!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE))
+		pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	return req->status;
+}
+
+int i2c_sched_peek(struct i2c_sched *s, uint16_t addr, uint8_t *buf, int len,
+  int prio)
+{
+	struct i2c_req req;
+
+	memset(&req, 0, sizeof(req));
+	req.prio = prio;
+	req.addr = addr;
+	req.len = len;
+	req.buf = buf;
+	i2c_sched_submit(s, &req);
+	return i2c_sched_wait(s, &req);
+}
+
+int i2c_sched_poke(struct i2c_sched *s, uint16_t addr, const uint8_t *buf,
+  int len, int prio)
+{
+	struct i2c_req req;
+
+	memset(&req, 0, sizeof(req));
+	req.write = 1;
+	req.prio = prio;
+	req.addr = addr;
+	req.len = len;
+	req.buf = (uint8_t *)buf;
+	i2c_sched_submit(s, &req);
+	return i2c_sched_wait(s, &req);
+}
+
+void i2c_sched_get_stats(struct i2c_sched *s, struct i2c_sched_stats *st)
+{
+	pthread_mutex_lock(&s->lock);
+	*st = s->st;
+	pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,57 @@
+#ifndef _I2C_SCHED_H_
+#define _I2C_SCHED_H_
+
+#include <stdint.h>
+
+// I2C transaction scheduler.  One thread owns an FPGA device context; any
+// thread submits requests through a lock-free queue.  Requests are served by
+// priority, and queued requests for adjacent registers of the same kind
+// and priority are merged into one burst transaction.
+
+#define I2C_PRIO_LOW		0	// background polling
+#define I2C_PRIO_NORMAL		1
+#define I2C_PRIO_HIGH		2	// setpoints, e.g. the DACs
+
+struct i2c_req;
+typedef void (*i2c_req_cb)(struct i2c_req *req, void *arg);
+
+// Owned by the caller and left untouched until completion.  cb, if set,
+// runs on the scheduler thread; otherwise wait with i2c_sched_wait().
+struct i2c_req {
+	int write;
+	int prio;
+	uint16_t addr;
+	int len;
+	uint8_t *buf;
+	i2c_req_cb cb;
+	void *arg;
+	int status;			// 0 or -1 once complete
+
+	// Private
+	struct i2c_req *next;
+	unsigned long seq;
+	int done;
+};
+
+struct i2c_sched_stats {
+	unsigned long requests;
+	unsigned long transactions;
+	unsigned long merged;		// requests that shared a transaction
+};
+
+struct i2c_sched;
+struct fpga_dev;
+
+struct i2c_sched *i2c_sched_new(struct fpga_dev *dev);
+// Serves whatever is still queued, then stops the thread
+void i2c_sched_free(struct i2c_sched *s);
+void i2c_sched_submit(struct i2c_sched *s, struct i2c_req *req);
+int i2c_sched_wait(struct i2c_sched *s, struct i2c_req *req);
+// Submit and wait
+int i2c_sched_peek(struct i2c_sched *s, uint16_t addr, uint8_t *buf, int len,
+  int prio);
+int i2c_sched_poke(struct i2c_sched *s, uint16_t addr, const uint8_t *buf,
+  int len, int prio);
+void i2c_sched_get_stats(struct i2c_sched *s, struct i2c_sched_stats *st);
+
+#endif //_I2C_SCHED_H_
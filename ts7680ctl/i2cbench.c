@@ -0,0 +1,361 @@
+/********************************************************************************/
+// i2cbench.c
+//	Compares FPGA register access patterns against the simulated I2C slave
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "fpga.h"
+#include "fpga-cache.h"
+#include "fpga-sim.h"
+#include "i2c-sched.h"
+
+// 0x40-0x4f lie between the UART and TTYMAX crossbar inputs and no input
+// uses them, so the write passes can't reroute a pin.  They are also clear
+// of the cache's volatile table and the DACs at 0x2E-0x35.
+#define BENCH_BASE	0x40
+#define BENCH_REGS	16
+
+// Scheduler pass: each producer owns BENCH_REGS / SCHED_PRODUCERS of the
+// registers and keeps up to SCHED_DEPTH writes queued
+#define SCHED_PRODUCERS	4
+#define SCHED_OWN	(BENCH_REGS / SCHED_PRODUCERS)
+#define SCHED_DEPTH	8
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct fpga_sim_stats before;
+
+static void start(double *t0)
+{
+	fpga_sim_get_stats(&before);
+	*t0 = now_ns();
+}
+
+// ops are one-byte register accesses.  bytes are what the simulator
+// clocked on the bus: slave addresses, register pointers and data alike.
+static void report(const char *name, double t0, long ops)
+{
+	struct fpga_sim_stats after;
+	double secs = (now_ns() - t0) / 1e9;
+	unsigned long wire;
+
+	fpga_sim_get_stats(&after);
+	wire = after.wire_bytes - before.wire_bytes;
+	printf("%-20s %10.0f ops/s %10.0f xfers/s %10.0f bytes/s %6.2f wire/byte\n",
+	  name, ops / secs, (after.transactions - before.transactions) / secs,
+	  wire / secs, (double)wire / ops);
+}
+
+/********************************************************************************/
+// Scheduler
+/********************************************************************************/
+
+struct producer {
+	struct i2c_sched *sched;
+	int id;
+	long n;
+	struct i2c_req *reqs;
+	uint8_t *vals;
+	long done;			// scheduler thread only
+	int errors;
+};
+
+// Requests of one producer all have the same priority, so they must
+// complete in the order they were submitted
+static void producer_done(struct i2c_req *req, void *arg)
+{
+	struct producer *p = arg;
+
+	if(req - p->reqs != p->done || req->status)
+		p->errors++;
+	p->done++;
+}
+
+static uint16_t producer_addr(struct producer *p, long k)
+{
+	return BENCH_BASE + p->id * SCHED_OWN + k % SCHED_OWN;
+}
+
+static void *producer_thread(void *arg)
+{
+	struct producer *p = arg;
+	uint8_t got[SCHED_OWN];
+	long k, w;
+	int i;
+
+	for(k = 0; k < p->n; k++) {
+		p->vals[k] = k * 7 + p->id;
+		p->reqs[k].write = 1;
+		p->reqs[k].prio = I2C_PRIO_NORMAL;
+		p->reqs[k].addr = producer_addr(p, k);
+		p->reqs[k].len = 1;
+		p->reqs[k].buf = &p->vals[k];
+		p->reqs[k].cb = producer_done;
+		p->reqs[k].arg = p;
+		i2c_sched_submit(p->sched, &p->reqs[k]);
+		if(k >= SCHED_DEPTH - 1)
+			i2c_sched_wait(p->sched, &p->reqs[k - SCHED_DEPTH + 1]);
+	}
+	for(w = p->n - SCHED_DEPTH + 1; w < p->n; w++) {
+		if(w >= 0)
+			i2c_sched_wait(p->sched, &p->reqs[w]);
+	}
+
+	// A read queued behind the writes sees the last value of each register
+	if(i2c_sched_peek(p->sched, producer_addr(p, 0), got, SCHED_OWN,
+	  I2C_PRIO_NORMAL))
+		p->errors++;
+	for(i = 0; i < SCHED_OWN && i < p->n; i++) {
+		k = p->n - 1 - (p->n - 1 - i) % SCHED_OWN;
+		if(got[i] != p->vals[k])
+			p->errors++;
+	}
+	return NULL;
+}
+
+// Requests submitted from a callback are all taken in before the next
+// transaction, so the order they are served in is fixed: high priority
+// first, then the low priority ones merged into one burst in age order
+struct prio_check {
+	struct i2c_sched *sched;
+	struct i2c_req low[SCHED_OWN], high;
+	uint8_t lowval[SCHED_OWN], highval;
+	int order[SCHED_OWN + 1], n;
+};
+
+static void prio_done(struct i2c_req *req, void *arg)
+{
+	struct prio_check *c = arg;
+
+	c->order[c->n++] = req == &c->high ? SCHED_OWN : req - c->low;
+}
+
+static void prio_gate(struct i2c_req *req, void *arg)
+{
+	struct prio_check *c = arg;
+	int i;
+
+	(void)req;
+	for(i = 0; i < SCHED_OWN; i++) {
+		c->lowval[i] = 0xa0 + i;
+		c->low[i].write = 1;
+		c->low[i].prio = I2C_PRIO_LOW;
+		c->low[i].addr = BENCH_BASE + i;
+		c->low[i].len = 1;
+		c->low[i].buf = &c->lowval[i];
+		c->low[i].cb = prio_done;
+		c->low[i].arg = c;
+		i2c_sched_submit(c->sched, &c->low[i]);
+	}
+	c->highval = 0x5a;
+	c->high.write = 1;
+	c->high.prio = I2C_PRIO_HIGH;
+	c->high.addr = BENCH_BASE + SCHED_OWN;
+	c->high.len = 1;
+	c->high.buf = &c->highval;
+	c->high.cb = prio_done;
+	c->high.arg = c;
+	i2c_sched_submit(c->sched, &c->high);
+}
+
+static int check_prio(struct fpga_dev *dev)
+{
+	struct i2c_sched_stats a, b;
+	struct prio_check c;
+	struct i2c_req gate;
+	uint8_t gateval = 0;
+	int i, errors = 0;
+
+	memset(&c, 0, sizeof(c));
+	c.sched = i2c_sched_new(dev);
+	if(!c.sched)
+		return 1;
+	i2c_sched_get_stats(c.sched, &a);
+	memset(&gate, 0, sizeof(gate));
+	gate.write = 1;
+	gate.addr = BENCH_BASE + BENCH_REGS - 1;
+	gate.len = 1;
+	gate.buf = &gateval;
+	gate.cb = prio_gate;
+	gate.arg = &c;
+	i2c_sched_submit(c.sched, &gate);
+	i2c_sched_wait(c.sched, &gate);
+	for(i = 0; i < SCHED_OWN; i++)
+		i2c_sched_wait(c.sched, &c.low[i]);
+	i2c_sched_wait(c.sched, &c.high);
+	i2c_sched_get_stats(c.sched, &b);
+	i2c_sched_free(c.sched);
+
+	if(c.n != SCHED_OWN + 1 || c.order[0] != SCHED_OWN)
+		errors++;
+	for(i = 1; i < c.n; i++) {
+		if(c.order[i] != i - 1)
+			errors++;
+	}
+	// gate, high, and one burst for the low ones
+	if(b.transactions - a.transactions != 3 || b.merged - a.merged != SCHED_OWN)
+		errors++;
+	if(errors)
+		fprintf(stderr, "sched: priority order or merge wrong\n");
+	return errors;
+}
+
+static int bench_sched(struct fpga_dev *dev, long iters)
+{
+	struct producer p[SCHED_PRODUCERS];
+	pthread_t t[SCHED_PRODUCERS];
+	struct i2c_sched_stats st;
+	struct i2c_sched *sched;
+	uint8_t *regs = fpga_sim_regs();
+	long n = iters * SCHED_OWN, k;
+	int i, j, errors = 0;
+	double t0;
+
+	sched = i2c_sched_new(dev);
+	if(!sched)
+		return 1;
+	memset(p, 0, sizeof(p));
+	for(i = 0; i < SCHED_PRODUCERS; i++) {
+		p[i].sched = sched;
+		p[i].id = i;
+		p[i].n = n;
+		p[i].reqs = calloc(n, sizeof(*p[i].reqs));
+		p[i].vals = calloc(n, 1);
+		if(!p[i].reqs || !p[i].vals)
+			return 1;
+	}
+
+	start(&t0);
+	for(i = 0; i < SCHED_PRODUCERS; i++) {
+		if(pthread_create(&t[i], NULL, producer_thread, &p[i]))
+			return 1;
+	}
+	for(i = 0; i < SCHED_PRODUCERS; i++)
+		pthread_join(t[i], NULL);
+	report("write sched x4", t0, SCHED_PRODUCERS * n);
+	i2c_sched_get_stats(sched, &st);
+	i2c_sched_free(sched);
+	printf("%-20s %10lu requests %10lu xfers %10lu merged\n", "",
+	  st.requests, st.transactions, st.merged);
+
+	// Every write landed: the registers hold each producer's last values
+	for(i = 0; i < SCHED_PRODUCERS; i++) {
+		errors += p[i].errors;
+		if(p[i].done != n)
+			errors++;
+		for(j = 0; j < SCHED_OWN && j < n; j++) {
+			k = n - 1 - (n - 1 - j) % SCHED_OWN;
+			if(regs[producer_addr(&p[i], k)] != p[i].vals[k])
+				errors++;
+		}
+		free(p[i].reqs);
+		free(p[i].vals);
+	}
+	if(st.requests != (unsigned long)SCHED_PRODUCERS * (n + 1))
+		errors++;
+	if(errors)
+		fprintf(stderr, "sched: %d errors\n", errors);
+	return errors + check_prio(dev);
+}
+
+int main(int argc, char **argv)
+{
+	long iters = 200, n;
+	unsigned latency = 22500;
+	uint8_t buf[BENCH_REGS];
+	struct fpga_dev *dev;
+	struct fpga_cache *cache;
+	int c, i;
+	double t0;
+
+	while((c = getopt(argc, argv, "n:l:h")) != -1) {
+		switch(c) {
+		case 'n':
+			iters = atol(optarg);
+			break;
+		case 'l':
+			latency = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-l ns-per-byte]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(iters <= 0)
+		iters = 1;
+
+	fpga_set_i2c_ops(&fpga_sim_ops);
+	fpga_sim_reset();
+	fpga_sim_set_latency(latency);
+	dev = fpga_open(NULL, 0);
+	if(!dev)
+		return 1;
+	printf("simulated FPGA: %u ns/byte, %d registers, %ld iterations\n",
+	  latency, BENCH_REGS, iters);
+
+	start(&t0);
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_REGS; i++)
+			fpga_peek8(dev, BENCH_BASE + i);
+	report("read  single", t0, iters * BENCH_REGS);
+
+	start(&t0);
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_REGS; i++)
+			fpga_poke8(dev, BENCH_BASE + i, n);
+	report("write single", t0, iters * BENCH_REGS);
+
+	start(&t0);
+	for(n = 0; n < iters; n++)
+		fpga_peekN(dev, BENCH_BASE, buf, BENCH_REGS);
+	report("read  burst", t0, iters * BENCH_REGS);
+
+	start(&t0);
+	for(n = 0; n < iters; n++) {
+		for(i = 0; i < BENCH_REGS; i++)
+			buf[i] = n;
+		fpga_pokeN(dev, BENCH_BASE, buf, BENCH_REGS);
+	}
+	report("write burst", t0, iters * BENCH_REGS);
+
+	// Cold start: the first pass misses, the rest are hits
+	cache = fpga_cache_new(dev);
+	if(!cache)
+		return 1;
+	start(&t0);
+	for(n = 0; n < iters; n++)
+		for(i = 0; i < BENCH_REGS; i++)
+			fpga_cache_peek(cache, BENCH_BASE + i);
+	report("read  cached", t0, iters * BENCH_REGS);
+
+	start(&t0);
+	for(n = 0; n < iters; n++) {
+		for(i = 0; i < BENCH_REGS; i++)
+			fpga_cache_poke(cache, BENCH_BASE + i, n);
+		fpga_cache_flush(cache);
+	}
+	report("write cached+flush", t0, iters * BENCH_REGS);
+
+	fpga_cache_free(cache);
+
+	if(bench_sched(dev, iters)) {
+		fpga_close(dev);
+		return 1;
+	}
+	fpga_close(dev);
+	return 0;
+}
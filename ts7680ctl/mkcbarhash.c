@@ -0,0 +1,61 @@
+/********************************************************************************/
+// mkcbarhash.c
+//	Build host tool: generates crossbar-hash.h, a perfect hash of the
+//	names in crossbar-ts7680.h
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crossbar.h"
+#include "crossbar-ts7680.h"
+
+#define SLOTS	256
+
+// Find a seed that sends every name to its own slot
+static int generate(const char *name, struct cbarpin *pins)
+{
+	unsigned char slot[SLOTS];
+	uint32_t seed;
+	int i, h;
+
+	for(seed = 1; seed; seed++) {
+		memset(slot, 0, sizeof(slot));
+		for(i = 0; pins[i].name; i++) {
+			h = cbar_hash(pins[i].name, seed) % SLOTS;
+			if(slot[h])
+				break;
+			slot[h] = i + 1;
+		}
+		if(!pins[i].name)
+			break;
+	}
+	if(!seed) {
+		fprintf(stderr, "No perfect hash for %s\n", name);
+		return -1;
+	}
+
+	printf("static const uint32_t cbar_%s_seed = 0x%x;\n", name, seed);
+	printf("// Index + 1 into ts7680_%ss[], 0 for an empty slot\n", name);
+	printf("static const uint8_t cbar_%s_slot[CBAR_HASH_SLOTS] = {", name);
+	for(i = 0; i < SLOTS; i++)
+		printf("%s%d,", i % 16 ? " " : "\n\t", slot[i]);
+	printf("\n};\n\n");
+	return 0;
+}
+
+int main(void)
+{
+	printf("// Generated by mkcbarhash from crossbar-ts7680.h, do not edit\n");
+	printf("#ifndef _CROSSBAR_HASH_H_\n#define _CROSSBAR_HASH_H_\n\n");
+	printf("#define CBAR_HASH_SLOTS\t%d\n\n", SLOTS);
+	// The register tables are ts7680_inputs[] and the selectable
+	// signals ts7680_outputs[]
+	if(generate("input", ts7680_inputs) || generate("output", ts7680_outputs))
+		return 1;
+	printf("#endif //_CROSSBAR_HASH_H_\n");
+	return 0;
+}
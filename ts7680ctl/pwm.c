@@ -0,0 +1,413 @@
+/********************************************************************************/
+// pwm.c
+//	Timer driven software PWM on DIO outputs
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "gpiolib.h"
+#include "pwm.h"
+
+#define PWM_ASAP	1	// "next" value for an edge due immediately
+
+struct pwm_chan {
+	int gpio;
+	int used;
+	int claimed;		// pin is exported and an output
+	uint64_t period;	// ns
+	uint64_t duty;
+	uint64_t new_period;
+	uint64_t new_duty;
+	int pending;		// new_* take effect at the next cycle start
+	int restart;		// begin a fresh cycle at the next edge
+	int level;
+	uint64_t next;		// absolute time of the next edge, 0 if none
+	uint64_t cycle_start;
+	uint64_t first_rise;
+	uint64_t last_rise;
+	unsigned long cycles;
+};
+
+struct pwm {
+	pthread_mutex_t lock;
+	// Held from choosing the levels to writing them, taken after lock, so
+	// a write can't land on a pin after pwm_remove() has driven it low
+	pthread_mutex_t write_lock;
+	pthread_t thread;
+	int running;
+	int timerfd;
+	int wakefd;
+	struct pwm_chan ch[PWM_MAX_CHANNELS];
+	unsigned long wakeups;
+	unsigned long edges;
+	unsigned long writes;
+	unsigned long timed;	// wakeups that had a real deadline
+	int64_t late_min;
+	int64_t late_max;
+	int64_t late_sum;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int toggling(struct pwm_chan *c)
+{
+	return c->period && c->duty && c->duty < c->period;
+}
+
+struct pwm *pwm_new(void)
+{
+	struct pwm *pwm;
+
+	pwm = calloc(1, sizeof(*pwm));
+	if(!pwm)
+		return NULL;
+	pthread_mutex_init(&pwm->lock, NULL);
+	pthread_mutex_init(&pwm->write_lock, NULL);
+	pwm->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	pwm->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(pwm->timerfd < 0 || pwm->wakefd < 0) {
+		perror("Couldn't create PWM timer");
+		pwm_free(pwm);
+		return NULL;
+	}
+	return pwm;
+}
+
+void pwm_free(struct pwm *pwm)
+{
+	if(!pwm)
+		return;
+	pwm_stop(pwm);
+	if(pwm->timerfd >= 0)
+		close(pwm->timerfd);
+	if(pwm->wakefd >= 0)
+		close(pwm->wakefd);
+	pthread_mutex_destroy(&pwm->lock);
+	pthread_mutex_destroy(&pwm->write_lock);
+	free(pwm);
+}
+
+// Exports the pin if it isn't already and makes it an output, as the
+// channel is about to drive it
+static int pwm_claim(int gpio)
+{
+	if(gpio_claim(gpio) < 0)
+		return -1;
+	if(pinMode(gpio, 1)) {
+		gpio_release(gpio);
+		return -1;
+	}
+	return 0;
+}
+
+static void pwm_wake(struct pwm *pwm)
+{
+	uint64_t one = 1;
+
+	write(pwm->wakefd, &one, sizeof(one));
+}
+
+int pwm_set(struct pwm *pwm, int gpio, unsigned period_us, unsigned duty_us)
+{
+	struct pwm_chan *c = NULL, *free_c = NULL;
+	int i;
+
+	pthread_mutex_lock(&pwm->lock);
+	for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+		if(pwm->ch[i].used && pwm->ch[i].gpio == gpio)
+			c = &pwm->ch[i];
+		else if(!pwm->ch[i].used && !free_c)
+			free_c = &pwm->ch[i];
+	}
+	if(!c) {
+		if(!free_c) {
+			pthread_mutex_unlock(&pwm->lock);
+			fprintf(stderr, "No free PWM channel for gpio %d\n", gpio);
+			return -1;
+		}
+		// The thread may be writing other channels' pins meanwhile
+		pthread_mutex_lock(&pwm->write_lock);
+		if(pwm_claim(gpio)) {
+			pthread_mutex_unlock(&pwm->write_lock);
+			pthread_mutex_unlock(&pwm->lock);
+			fprintf(stderr, "Couldn't make gpio %d a PWM output\n", gpio);
+			return -1;
+		}
+		pthread_mutex_unlock(&pwm->write_lock);
+		c = free_c;
+		memset(c, 0, sizeof(*c));
+		c->gpio = gpio;
+		c->used = 1;
+		c->claimed = 1;
+		c->restart = 1;
+	}
+
+	c->new_period = (uint64_t)period_us * 1000;
+	c->new_duty = (uint64_t)duty_us * 1000;
+	c->pending = 1;
+	// A pin that isn't toggling has no cycle to wait for
+	if(c->restart || !toggling(c)) {
+		c->restart = 1;
+		c->next = PWM_ASAP;
+	}
+	pthread_mutex_unlock(&pwm->lock);
+
+	pwm_wake(pwm);
+	return 0;
+}
+
+int pwm_remove(struct pwm *pwm, int gpio)
+{
+	int i, ret = -1, claimed = 0;
+
+	pthread_mutex_lock(&pwm->lock);
+	for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+		if(pwm->ch[i].used && pwm->ch[i].gpio == gpio) {
+			pwm->ch[i].used = 0;
+			claimed = pwm->ch[i].claimed;
+			ret = 0;
+		}
+	}
+	// A bulk write the thread already chose levels for goes out first
+	pthread_mutex_lock(&pwm->write_lock);
+	pthread_mutex_unlock(&pwm->lock);
+	if(claimed) {
+		digitalWrite(gpio, 0);
+		gpio_release(gpio);
+	}
+	pthread_mutex_unlock(&pwm->write_lock);
+	if(!ret)
+		pwm_wake(pwm);
+	return ret;
+}
+
+// Advance one channel past the edge scheduled at s, now being the time the
+// edge actually goes out.  Returns the new level.
+static int pwm_step(struct pwm_chan *c, uint64_t s, uint64_t now)
+{
+	if(c->next == PWM_ASAP)
+		s = now;
+
+	if(!c->restart && c->level && toggling(c)) {
+		// Falling edge
+		c->level = 0;
+		c->next = c->cycle_start + c->period;
+		return 0;
+	}
+
+	// Cycle start
+	if(c->pending) {
+		// Measure the achieved frequency afresh for a new period
+		if(c->new_period != c->period) {
+			c->first_rise = 0;
+			c->cycles = 0;
+		}
+		c->period = c->new_period;
+		c->duty = c->new_duty;
+		c->pending = 0;
+	}
+	c->restart = 0;
+	if(!toggling(c)) {
+		c->level = c->duty && c->duty >= c->period;
+		c->next = 0;
+		return c->level;
+	}
+
+	// Too far behind to catch up: drop whole periods instead of bursting
+	while(s + c->period <= now)
+		s += c->period;
+
+	c->level = 1;
+	c->cycle_start = s;
+	c->next = s + c->duty;
+	if(!c->first_rise)
+		c->first_rise = s;
+	c->last_rise = s;
+	c->cycles++;
+	return 1;
+}
+
+static void *pwm_thread(void *arg)
+{
+	struct pwm *pwm = arg;
+	struct pollfd pfd[2];
+	struct itimerspec its;
+	int pins[PWM_MAX_CHANNELS];
+	uint64_t due, now, cnt, vals;
+	int64_t late;
+	int i, n;
+
+	pfd[0].fd = pwm->wakefd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = pwm->timerfd;
+	pfd[1].events = POLLIN;
+
+	while(__atomic_load_n(&pwm->running, __ATOMIC_ACQUIRE)) {
+		// Not every pass polls, and a stale revents would eat a wakeup
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		pthread_mutex_lock(&pwm->lock);
+		due = 0;
+		for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+			if(pwm->ch[i].used && pwm->ch[i].next &&
+			  (!due || pwm->ch[i].next < due))
+				due = pwm->ch[i].next;
+		}
+		pthread_mutex_unlock(&pwm->lock);
+
+		if(due > PWM_ASAP) {
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = due / 1000000000ULL;
+			its.it_value.tv_nsec = due % 1000000000ULL;
+			timerfd_settime(pwm->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+			poll(pfd, 2, -1);
+		} else if(!due) {
+			poll(pfd, 1, -1);
+		}
+		if(pfd[0].revents)
+			read(pwm->wakefd, &cnt, sizeof(cnt));
+		if(pfd[1].revents)
+			read(pwm->timerfd, &cnt, sizeof(cnt));
+
+		now = now_ns();
+		if(!due || now < due)
+			continue;
+
+		pthread_mutex_lock(&pwm->lock);
+		pwm->wakeups++;
+		if(due > PWM_ASAP) {
+			late = now - due;
+			if(!pwm->timed || late < pwm->late_min)
+				pwm->late_min = late;
+			if(late > pwm->late_max)
+				pwm->late_max = late;
+			pwm->late_sum += late;
+			pwm->timed++;
+		}
+
+		// Every edge that is due by now goes out in one bulk write
+		n = 0;
+		vals = 0;
+		for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+			struct pwm_chan *c = &pwm->ch[i];
+
+			if(!c->used || !c->next || c->next > now)
+				continue;
+			if(pwm_step(c, c->next, now))
+				vals |= 1ULL << n;
+			pins[n++] = c->gpio;
+		}
+
+		if(n) {
+			pwm->edges += n;
+			pwm->writes++;
+		}
+		pthread_mutex_lock(&pwm->write_lock);
+		pthread_mutex_unlock(&pwm->lock);
+
+		if(n)
+			digitalWriteMask(pins, n, ~0ULL, vals);
+		pthread_mutex_unlock(&pwm->write_lock);
+	}
+	return NULL;
+}
+
+int pwm_start(struct pwm *pwm)
+{
+	int i;
+
+	if(pwm->running)
+		return -1;
+	for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+		if(pwm->ch[i].used) {
+			// pwm_stop() released the pins
+			if(!pwm->ch[i].claimed) {
+				if(pwm_claim(pwm->ch[i].gpio)) {
+					fprintf(stderr, "Couldn't make gpio %d a PWM output\n",
+					  pwm->ch[i].gpio);
+					return -1;
+				}
+				pwm->ch[i].claimed = 1;
+			}
+			pwm->ch[i].restart = 1;
+			pwm->ch[i].next = PWM_ASAP;
+		}
+	}
+	pwm->running = 1;
+	if(pthread_create(&pwm->thread, NULL, pwm_thread, pwm)) {
+		pwm->running = 0;
+		perror("Couldn't start PWM thread");
+		return -1;
+	}
+	return 0;
+}
+
+void pwm_stop(struct pwm *pwm)
+{
+	int pins[PWM_MAX_CHANNELS];
+	int i, n = 0;
+
+	if(pwm->running) {
+		__atomic_store_n(&pwm->running, 0, __ATOMIC_RELEASE);
+		pwm_wake(pwm);
+		pthread_join(pwm->thread, NULL);
+	}
+
+	// Also reached from pwm_free() for channels that never ran
+	for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+		if(pwm->ch[i].used && pwm->ch[i].claimed) {
+			pwm->ch[i].level = 0;
+			pwm->ch[i].claimed = 0;
+			pins[n++] = pwm->ch[i].gpio;
+		}
+	}
+	if(n)
+		digitalWriteMask(pins, n, ~0ULL, 0);
+	for(i = 0; i < n; i++)
+		gpio_release(pins[i]);
+}
+
+void pwm_get_stats(struct pwm *pwm, struct pwm_stats *st)
+{
+	struct pwm_chan *c;
+	int i;
+
+	memset(st, 0, sizeof(*st));
+	pthread_mutex_lock(&pwm->lock);
+	st->wakeups = pwm->wakeups;
+	st->edges = pwm->edges;
+	st->writes = pwm->writes;
+	st->late_min_ns = pwm->late_min;
+	st->late_max_ns = pwm->late_max;
+	if(pwm->timed)
+		st->late_avg_ns = pwm->late_sum / (int64_t)pwm->timed;
+	for(i = 0; i < PWM_MAX_CHANNELS; i++) {
+		c = &pwm->ch[i];
+		if(!c->used)
+			continue;
+		st->ch[st->nchannels].gpio = c->gpio;
+		st->ch[st->nchannels].cycles = c->cycles;
+		if(c->cycles > 1 && c->last_rise > c->first_rise)
+			st->ch[st->nchannels].freq_hz = (c->cycles - 1) * 1e9 /
+			  (double)(c->last_rise - c->first_rise);
+		st->nchannels++;
+	}
+	pthread_mutex_unlock(&pwm->lock);
+}
@@ -0,0 +1,45 @@
+#ifndef _PWM_H_
+#define _PWM_H_
+
+#include <stdint.h>
+
+// Software PWM on DIO outputs.  One thread drives every channel from an
+// absolute CLOCK_MONOTONIC schedule; edges due at the same instant go out
+// together through digitalWriteMask().
+
+#define PWM_MAX_CHANNELS	16
+
+struct pwm_channel_stats {
+	int gpio;
+	unsigned long cycles;
+	double freq_hz;			// achieved, from first to last rising edge
+};
+
+struct pwm_stats {
+	unsigned long wakeups;
+	unsigned long edges;
+	unsigned long writes;		// bulk writes issued (edges merged per write)
+	int64_t late_min_ns;		// wakeup lateness against the deadline
+	int64_t late_max_ns;
+	int64_t late_avg_ns;
+	int nchannels;
+	struct pwm_channel_stats ch[PWM_MAX_CHANNELS];
+};
+
+struct pwm;
+
+struct pwm *pwm_new(void);
+void pwm_free(struct pwm *pwm);
+// Adds or updates a channel, claiming a new channel's pin and making it an
+// output.  duty_us of 0 or >= period_us holds the pin low or high.
+// Changes to a running channel apply from its next cycle.
+int pwm_set(struct pwm *pwm, int gpio, unsigned period_us, unsigned duty_us);
+// Drives the pin low and releases it
+int pwm_remove(struct pwm *pwm, int gpio);
+int pwm_start(struct pwm *pwm);
+// Stops the thread, drives every channel low and releases the pins;
+// pwm_start() claims them again
+void pwm_stop(struct pwm *pwm);
+void pwm_get_stats(struct pwm *pwm, struct pwm_stats *st);
+
+#endif //_PWM_H_
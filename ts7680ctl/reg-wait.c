@@ -0,0 +1,85 @@
+/********************************************************************************/
+// reg-wait.c
+//	Spin-then-sleep wait on memory-mapped status registers
+//
+//	Copyright (c) 2017 Joshua Holder - Custom Controls Unlimited Inc.
+/********************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "reg-wait.h"
+
+#define BACKOFF_MIN_US	10
+#define BACKOFF_MAX_US	1000
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_us(unsigned us)
+{
+	struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+	nanosleep(&ts, NULL);
+}
+
+void reg_wait_init(struct reg_wait *w, unsigned timeout_us)
+{
+	memset(w, 0, sizeof(*w));
+	w->timeout_us = timeout_us ? timeout_us : REG_WAIT_TIMEOUT_US;
+	w->spin_us = REG_WAIT_SPIN_US;
+}
+
+static int done(volatile uint32_t *reg, uint32_t mask, uint32_t value)
+{
+	return (*reg & mask) == value;
+}
+
+int reg_wait(struct reg_wait *w, volatile uint32_t *reg, uint32_t mask,
+  uint32_t value)
+{
+	uint64_t start, now, deadline;
+	unsigned backoff = BACKOFF_MIN_US;
+	unsigned elapsed;
+
+	w->waits++;
+	if(done(reg, mask, value))
+		return 0;
+	start = now_us();
+	deadline = start + w->timeout_us;
+
+	// Sleep through the part of the wait that is known to be needed
+	if(w->avg_us > w->spin_us) {
+		sleep_us(w->avg_us - w->avg_us / 4);
+		w->sleeps++;
+	}
+	for(now = now_us(); !done(reg, mask, value); now = now_us()) {
+		if(now >= deadline) {
+			if(done(reg, mask, value))
+				break;
+			w->timeouts++;
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		// Spin a little past the expected completion, then back off
+		if(now - start < w->avg_us + w->spin_us)
+			continue;
+		if(backoff > deadline - now)
+			backoff = deadline - now;
+		sleep_us(backoff);
+		w->sleeps++;
+		if(backoff < BACKOFF_MAX_US)
+			backoff *= 2;
+	}
+
+	elapsed = now - start;
+	w->avg_us = w->avg_us ? (w->avg_us * 7 + elapsed) / 8 : elapsed;
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _REG_WAIT_H_
+#define _REG_WAIT_H_
+
+#include <stdint.h>
+
+// Waits for bits in a memory-mapped register without burning the CPU for
+// the whole conversion.  Each waiter learns how long its condition usually
+// takes: it sleeps through most of that, spins briefly around the expected
+// completion, then backs off in growing sleeps until the deadline.
+
+struct reg_wait {
+	unsigned timeout_us;	// give up this long after the wait starts
+	unsigned spin_us;	// longest busy-poll before sleeping
+	unsigned avg_us;	// running average of completion times
+	unsigned long waits;
+	unsigned long timeouts;
+	unsigned long sleeps;
+};
+
+#define REG_WAIT_TIMEOUT_US	100000
+#define REG_WAIT_SPIN_US	20
+
+void reg_wait_init(struct reg_wait *w, unsigned timeout_us);
+// Waits until (*reg & mask) == value.  0, or -1 with errno ETIMEDOUT.
+int reg_wait(struct reg_wait *w, volatile uint32_t *reg, uint32_t mask,
+  uint32_t value);
+
+#endif //_REG_WAIT_H_
@@ -18,247 +18,27 @@
 #include <errno.h>
 #include <math.h>
 #include <getopt.h>
+#include <signal.h>
 
 #include "gpiolib.h"
 #include "fpga.h"
-#include "crossbar-ts7680.h"
+#include "crossbar.h"
+#include "fpga-config.h"
 #include "i2c-dev.h"
+#include "counter.h"
+#include "pwm.h"
+#include "capture.h"
+#include "adc.h"
+#include "adc-stream.h"
+#include "reg-wait.h"
 
 
 
-/********************************************************************************/
-// fpga dependencies
-/********************************************************************************/
-int fpga_init(char *path, char adr)
-{
-        static int fd = -1;
-
-        if(fd != -1)
-                return fd;
-
-        if(path == NULL) {
-                // Will always be I2C0 on the 7680
-                fd = open("/dev/i2c-0", O_RDWR);
-        } else {
-
-                fd = open(path, O_RDWR);
-        }
-
-        if(!adr) adr = 0x28;
-
-        if(fd != -1) {
-                if (ioctl(fd, I2C_SLAVE_FORCE, 0x28) < 0) {
-                        perror("FPGA did not ACK 0x28\n");
-                        return -1;
-                }
-        }
-
-        return fd;
-}
-
-void fpoke8(int twifd, uint16_t addr, uint8_t value)
-{
-        uint8_t data[3];
-        data[0] = ((addr >> 8) & 0xff);
-        data[1] = (addr & 0xff);
-        data[2] = value;
-        if (write(twifd, data, 3) != 3) {
-                perror("I2C Write Failed");
-        }
-}
-
-uint8_t fpeek8(int twifd, uint16_t addr)
-{
-        uint8_t data[2];
-        data[0] = ((addr >> 8) & 0xff);
-        data[1] = (addr & 0xff);
-        if (write(twifd, data, 2) != 2) {
-                perror("I2C Address set Failed");
-        }
-        read(twifd, data, 1);
-
-        return data[0];
-}
-
-
-/********************************************************************************/
-// Digital IO and two Relays Setup
-/********************************************************************************/
-int pinMode(int gpio, int dir)
-{
-	int ret = 0;
-	char buf[50];
-	sprintf(buf, "/sys/class/gpio/gpio%d/direction", gpio);
-	int gpiofd = open(buf, O_WRONLY);
-	if(gpiofd < 0) {
-		perror("Couldn't open IRQ file");
-		ret = -1;
-	}
-
-	if(dir == 1 && gpiofd){
-		if (3 != write(gpiofd, "out", 3)) {
-			perror("Couldn't set GPIO direction to out");
-			ret = -2;
-		}
-	}
-	else if(gpiofd) {
-		if(2 != write(gpiofd, "in", 2)) {
-			perror("Couldn't set GPIO directio to in");
-			ret = -3;
-		}
-	}
-
-	close(gpiofd);
-	return ret;
-}
-
-int gpio_setedge(int gpio, int rising, int falling)
-{
-        int ret = 0;
-        char buf[50];
-        sprintf(buf, "/sys/class/gpio/gpio%d/edge", gpio);
-        int gpiofd = open(buf, O_WRONLY);
-        if(gpiofd < 0) {
-                perror("Couldn't open IRQ file");
-                ret = -1;
-        }
-        
-        if(gpiofd && rising && falling) {
-                if(4 != write(gpiofd, "both", 4)) {
-                        perror("Failed to set IRQ to both falling & rising");
-                        ret = -2;
-                }
-        } else {
-                if(rising && gpiofd) {
-                        if(6 != write(gpiofd, "rising", 6)) {
-                                perror("Failed to set IRQ to rising");
-                                ret = -2;
-                        }
-                } else if(falling && gpiofd) {
-                        if(7 != write(gpiofd, "falling", 7)) {
-                                perror("Failed to set IRQ to falling");
-                                ret = -3;
-                        }
-                }
-        }
-        
-        close(gpiofd);
-        return ret;
-}
-
-int gpio_select(int gpio)
-{
-	char gpio_irq[64];
-	int ret = 0, buf, irqfd;
-	fd_set fds;
-	FD_ZERO(&fds);
-
-	snprintf(gpio_irq, sizeof(gpio_irq), "/sys/class/gpio/gpio%d/value", gpio);
-	irqfd = open(gpio_irq, O_RDONLY, S_IREAD);
-	if(irqfd < 1) {
-		perror("Couldn't open the value file");
-		return -1;
-	}
-
-	// Read first since there is always an initial status
-	read(irqfd, &buf, sizeof(buf));
-
-	while(1) {
-		FD_SET(irqfd, &fds);
-		ret = select(irqfd + 1, NULL, NULL, &fds, NULL);
-		if(FD_ISSET(irqfd, &fds))
-		{
-			FD_CLR(irqfd, &fds);  //Remove the filedes from set
-			// Clear the junk data in the IRQ file
-			read(irqfd, &buf, sizeof(buf));
-			return 1;
-		}
-	}
-}
-
-int gpio_export(int gpio)
-{
-        int efd;
-        char buf[50];
-        int ret;
-        efd = open("/sys/class/gpio/export", O_WRONLY);
-        
-        if(efd != -1) {
-                sprintf(buf, "%d", gpio);
-                ret = write(efd, buf, strlen(buf));
-                if(ret < 0) {
-                        perror("Export failed");
-                        return -2;
-                }
-                close(efd);
-        } else {
-                // If we can't open the export file, we probably
-                // don't have any gpio permissions
-                return -1;
-        }
-        return 0;
-}
-
-void gpio_unexport(int gpio)
-{
-        int gpiofd;
-        char buf[50];
-        gpiofd = open("/sys/class/gpio/unexport", O_WRONLY);
-        sprintf(buf, "%d", gpio);
-        write(gpiofd, buf, strlen(buf));
-        close(gpiofd);
-}
-
-int digitalRead(int gpio)
-{
-        char in[3] = {0, 0, 0};
-        char buf[50];
-        int nread, gpiofd;
-        sprintf(buf, "/sys/class/gpio/gpio%d/value", gpio);
-        gpiofd = open(buf, O_RDWR);
-        if(gpiofd < 0) {
-                fprintf(stderr, "Failed to open gpio %d value\n", gpio);
-                perror("gpio failed");
-        }
-        
-        do {
-                nread = read(gpiofd, in, 1);
-        } while (nread == 0);
-        if(nread == -1){
-                perror("GPIO Read Failed");
-                return -1;
-        }
-        
-        close(gpiofd);
-        return atoi(in);
-}
-
-int digitalWrite(int gpio, int val)
-{
-        char buf[50];
-        int ret, gpiofd;
-        sprintf(buf, "/sys/class/gpio/gpio%d/value", gpio);
-        gpiofd = open(buf, O_RDWR);
-        if(gpiofd > 0) {
-                snprintf(buf, 2, "%d", val);
-                ret = write(gpiofd, buf, 2);
-                if(ret < 0) {
-                        perror("failed to set gpio");
-                        return 1;
-                }
-                
-                close(gpiofd);
-                if(ret == 2) return 0;
-        }
-        return 1;
-}
-
-
 /********************************************************************************/
 // Analog Outputs for TS-7680
 /********************************************************************************/
 
-static int twifd;
+static struct fpga_dev *fpga;
 
 int get_model()
 {
@@ -278,129 +58,78 @@ int get_model()
 
 int dac(int dacpin, int value)
 {
-	value = value * 360;
-	switch(dacpin) {
-		case '0': 
-			char buf[2];
-        			buf[0] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 9) & 0xf);
-				buf[1] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 1) & 0xff);
-				fpoke8(twifd, 0x2E, buf[0]);
-				fpoke8(twifd, 0x2F, buf[1]);
-			break;
-		case '1' : 
-			char buf[2];
-                		buf[0] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 9) & 0xf);
-                		buf[1] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 1) & 0xff);
-                		fpoke8(twifd, 0x30, buf[0]);
-                		fpoke8(twifd, 0x31, buf[1]);
-			break;
-		case '2' : 
-			char buf[2];
-				buf[0] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 9) & 0xf);
-				buf[1] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 1) & 0xff);
-				fpoke8(twifd, 0x32, buf[0]);
-				fpoke8(twifd, 0x33, buf[1]);
-			break;
-		case '3' : 
-			char buf[2];
-				buf[0] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 9) & 0xf);
-				buf[1] = ((((strtoul(value, NULL, 0) & 0xfff)<<1)|0x1 >> 1) & 0xff);
-				fpoke8(twifd, 0x34, buf[0]);
-				fpoke8(twifd, 0x35, buf[1]);
-			break;
-		default : 
-			return 1;
-	}
+	uint16_t values[FPGA_DAC_CHANNELS] = {0, 0, 0, 0};
+
+	// Accept the channel as a number or as a character
+	if(dacpin >= '0' && dacpin <= '3')
+		dacpin -= '0';
+	if(dacpin < 0 || dacpin >= FPGA_DAC_CHANNELS)
+		return 1;
+	values[dacpin] = (value * 360) & 0xfff;
+	return dac_update(fpga, 1U << dacpin, values) ? 1 : 0;
 }
-			
 
 /********************************************************************************/
 // Analog Inputs
 /********************************************************************************/
 
+static struct adc_dev *adc;
+
+// Maps the ADC blocks and brings the converters up on first use only
+static struct adc_dev *get_adc(void)
+{
+        if(!adc) {
+                adc = adc_open(NULL);
+                if(!adc)
+                        exit(1);
+        }
+        return adc;
+}
+
 int analogInMode(int adcpin, int mode)
 {
-	volatile unsigned int *mxlradcregs;
-        volatile unsigned int *mxhsadcregs;
-        volatile unsigned int *mxclkctrlregs;
-	unsigned int i, x, meas_mV, meas_mA;
-        unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-	int devmem;
-	int mv, ma;
+        if(mode == ADC_MODE_MA)
+                return adc_read_ma(get_adc(), adcpin);
+        return adc_read_mv(get_adc(), adcpin);
+}
+
+/********************************************************************************/
+// Board Info
+/********************************************************************************/
+
+// Low 24 bits of the MAC address from the OCOTP fuses
+static int read_mac(unsigned int *mac)
+{
+        volatile unsigned int *mxocotpregs;
+        struct reg_wait busy;
+        int devmem, ret = -1;
         
         devmem = open("/dev/mem", O_RDWR|O_SYNC);
-	assert(devmem != -1);
-        
-        // LRADC
-	mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-	  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-        mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-        mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-        mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-        for(x = 0; x < 7; x++)
-          mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-        for(x = 0; x < 10; x++) {
-                mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-	        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                for(i = 0; i < 7; i++)
-                  chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-	}
-        
-        mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-	  devmem, 0x80002000);
-	mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-          devmem, 0x80040000);
-        
-	//HSADC
-	//See if the HSADC needs to be brought out of reset
-	if(mxhsadcregs[0x0/4] & 0xc0000000) {
-		mxclkctrlregs[0x154/4] = 0x70000000;
-	        mxclkctrlregs[0x1c8/4] = 0x8000;
-                //ENGR116296 errata workaround
-		mxhsadcregs[0x8/4] = 0x80000000;
-		mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-	        mxhsadcregs[0x4/4] = 0x40000000;
-                mxhsadcregs[0x8/4] = 0x40000000;
-	        mxhsadcregs[0x4/4] = 0x40000000;
-                
-	        usleep(10);
-		mxhsadcregs[0x8/4] = 0xc0000000;
-	}
-        
-        mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-        mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-        mxhsadcregs[0x30/4] = 0xa; //Set sample num
-        mxhsadcregs[0x40/4] = 0x1; //Set seq num
-        mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-        while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                mxhsadcregs[0x50/4]; //Empty FIFO
-        }
-        
-        mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-        mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-        mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-        usleep(10);
-        mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-        while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-        for(i = 0; i < 5; i++) {
-                x = mxhsadcregs[0x50/4];
-                chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+        assert(devmem != -1);
+        mxocotpregs = (unsigned int *) mmap(0, getpagesize(),
+          PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x8002C000);
+        
+        reg_wait_init(&busy, 0);
+        mxocotpregs[0x08/4] = 0x200;
+        mxocotpregs[0x0/4] = 0x1000;
+        if(reg_wait(&busy, &mxocotpregs[0x0/4], 0x100, 0)) //check busy flag
+                goto out;
+        *mac = mxocotpregs[0x20/4] & 0xFFFFFF;
+        if(!*mac) {
+                mxocotpregs[0x0/4] = 0x0; //close the reg first
+                mxocotpregs[0x08/4] = 0x200;
+                mxocotpregs[0x0/4] = 0x1013;
+                if(reg_wait(&busy, &mxocotpregs[0x0/4], 0x100, 0)) //check busy flag
+                        goto out;
+                *mac = (unsigned short) mxocotpregs[0x150/4];
+                *mac |= 0x4f0000;
         }
-        
-	if(mode == mv) {
-		meas_mV = ((((chan[adcpin]/10)*45177)*6235)/100000000);
-		return meas_mV; }
-	if(mode == ma) {
-		meas_mV = ((((chan[adcpin]/10)*45177)*6235)/100000000);
-		meas_mA = (((meas_mV)*1000)/240); }
-	else {
-		return 0; }                
+        ret = 0;
+out:
+        mxocotpregs[0x0/4] = 0x0;
+        munmap((void *)mxocotpregs, getpagesize());
+        close(devmem);
+        return ret;
 }
 
 
@@ -422,6 +151,12 @@ void usage(char **argv) {
                 "  -m, --getmac                 Display ethernet MAC address\n"
                 "  -o, --ddrout <dio>           Set sysfs DIO to an output\n"
                 "  -e, --ddrin <dio>            Set sysfs DIO to an input\n"
+                "  -k, --keep-exported          Leave DIOs exported after use (also\n"
+                "                               set by TS7680CTL_KEEP_EXPORTED=1)\n"
+                "  -B, --backend <name>         GPIO access method: sysfs (default)\n"
+                "                               cdev or mmap (TS7680CTL_GPIO_BACKEND)\n"
+                "  -f, --manifest <file>        Export and set up the DIOs listed\n"
+                "                               in <file> and keep them exported\n"
                 "\n"
                 "*******************Set Digital and Analog Outputs*****************\n"
                 "\n"
@@ -443,11 +178,164 @@ void usage(char **argv) {
                 "  -x, --getadcV1               Return the input mV value of ADC1\n"
                 "  -y, --getadcV2               Return the input mV value of ADC2\n"
                 "  -z, --getadcV3               Return the input mV value of ADC3\n"
+                "  -O, --oversample [<ch>:]<n>  Average <n> LRADC samples (1-32, default\n"
+                "                               10) summed in hardware, for channel <ch>\n"
+                "                               or all of them (may be repeated)\n"
+                "  -M, --stream <file>          Sample the --stream-ch inputs at a fixed\n"
+                "                               rate into <file> (- for stdout) as binary\n"
+                "                               frames, or CSV with --format csv\n"
+                "  -X, --stream-ch <list>       ADC channels to stream, e.g. 0,1,7\n"
+                "                               (default 0,1,2,3; 7 is the HSADC)\n"
+                "  -Q, --stream-rate <hz>       Frames per second, 1-10000 (default 1000)\n"
+                "  -Y, --stream-time <s>        Stream length (default 0, until Ctrl-C);\n"
+                "                               oversampling is 1 unless --oversample\n"
+                "  -C, --count <dio>            Count rising edges on DIO <n> (may be\n"
+                "                               repeated) and print count and frequency\n"
+                "  -W, --window <ms>            Counting time for --count (default 1000)\n"
+                "  -U, --pwm <dio>:<period>:<duty>\n"
+                "                               Drive DIO <n> with software PWM, period\n"
+                "                               and duty in us (may be repeated), then\n"
+                "                               print achieved frequency and lateness\n"
+                "  -V, --pwm-time <ms>          Run time for --pwm (default 1000)\n"
+                "  -L, --capture <file>         Record transitions of the --capture-pin\n"
+                "                               inputs to <file>\n"
+                "  -P, --capture-pin <dio>      Pin to record (may be repeated)\n"
+                "  -T, --capture-time <s>       Capture length in seconds (default 10)\n"
+                "  -N, --capture-max <n>        Transitions the file can hold (default 1M)\n"
+                "  -G, --cbar-get               Print the crossbar routing as OUT=IN\n"
+                "  -S, --cbar-set <OUT=IN>      Route signal IN to OUT (may be repeated)\n"
+                "  -A, --cbar-apply <file>      Apply the OUT=IN routes listed in <file>\n"
+                "  -R, --load-config <file>     Restore the crossbar and DACs from an\n"
+                "                               image made by --save-config\n"
+                "  -E, --save-config <file>     Save the crossbar and DAC setup to <file>\n"
+                "  -D, --decode <file>          Print a capture file and exit\n"
+                "  -F, --format <vcd|csv>       Output format for --decode (default vcd)\n"
+                "                               and --stream (csv, default binary)\n"
                 "\n",
                 argv[0]
         );
 }
 
+// "<n>" for every LRADC input or "<ch>:<n>" for one
+static int parse_oversample(const char *arg, int oversample[ADC_CHANNELS])
+{
+        const char *colon = strchr(arg, ':');
+        int ch = colon ? atoi(arg) : -1;
+        int n = atoi(colon ? colon + 1 : arg);
+        int i;
+        
+        if(n < 1 || n > ADC_OVERSAMPLE_MAX || ch < -1 || ch >= ADC_HSADC_CHANNEL) {
+                fprintf(stderr, "Bad --oversample %s\n", arg);
+                return 1;
+        }
+        for(i = 0; i < ADC_HSADC_CHANNEL; i++) {
+                if(ch == -1 || ch == i)
+                        oversample[i] = n;
+        }
+        return 0;
+}
+
+// "<dio>:<period_us>:<duty_us>"
+struct pwm_opt {
+        int gpio;
+        unsigned period_us;
+        unsigned duty_us;
+};
+
+static int parse_pwm(const char *arg, struct pwm_opt *p)
+{
+        if(sscanf(arg, "%d:%u:%u", &p->gpio, &p->period_us, &p->duty_us) != 3 ||
+          p->gpio < 0 || p->gpio >= GPIO_MAX_PINS || !p->period_us) {
+                fprintf(stderr, "Bad --pwm %s\n", arg);
+                return 1;
+        }
+        return 0;
+}
+
+// Comma separated ADC channel numbers into a mask
+static int parse_channels(const char *arg, unsigned *mask)
+{
+        const char *p = arg;
+        char *end;
+        long ch;
+        
+        *mask = 0;
+        do {
+                ch = strtol(p, &end, 0);
+                if(end == p || ch < 0 || ch >= ADC_CHANNELS ||
+                  (*end && *end != ',')) {
+                        fprintf(stderr, "Bad channel list %s\n", arg);
+                        return 1;
+                }
+                *mask |= 1U << ch;
+                p = end + 1;
+        } while(*end);
+        return 0;
+}
+
+static int parse_rate(const char *arg, unsigned *rate)
+{
+        char *end;
+        unsigned long hz;
+        
+        hz = strtoul(arg, &end, 0);
+        if(end == arg || *end || !hz || hz > ADC_STREAM_MAX_RATE) {
+                fprintf(stderr, "Bad stream rate %s, 1 to %d Hz\n", arg,
+                  ADC_STREAM_MAX_RATE);
+                return 1;
+        }
+        *rate = hz;
+        return 0;
+}
+
+static void stream_signal(int sig)
+{
+        (void)sig;
+        adc_stream_stop();
+}
+
+static int stream(const char *path, unsigned mask, unsigned rate,
+  unsigned seconds, int format)
+{
+        struct adc_stream_stats st;
+        struct adc_stream *s;
+        FILE *out;
+        int ret;
+        
+        s = adc_stream_new(get_adc(), mask, rate, rate);
+        if(!s) {
+                perror("stream");
+                return 1;
+        }
+        out = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+        if(!out) {
+                perror(path);
+                adc_stream_free(s);
+                return 1;
+        }
+        signal(SIGINT, stream_signal);
+        signal(SIGTERM, stream_signal);
+        ret = adc_stream_run(s, out, format, seconds * 1000);
+        if(ret)
+                perror(path);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        if(out != stdout && fclose(out)) {
+                perror(path);
+                ret = -1;
+        }
+        
+        adc_stream_get_stats(s, &st);
+        fprintf(stderr, "frames=%lu missed=%lu dropped=%lu errors=%lu late_max=%lldus\n",
+          st.frames, st.missed, st.dropped, st.errors,
+          (long long)(st.late_max_ns / 1000));
+        if(!st.realtime)
+                fprintf(stderr, "Sampler ran at normal priority; run as root "
+                  "for SCHED_FIFO\n");
+        adc_stream_free(s);
+        return ret ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
         int c;
@@ -457,6 +345,20 @@ int main(int argc, char **argv)
         int opt_dac0 = 0, opt_dac1 = 0, opt_dac2 = 0, opt_dac3 = 0;
         int opt_mAadc0 = 0, opt_mAadc1 = 0, opt_mAadc2 = 0, opt_mAadc3 = 0;
         int opt_mVadc0 = 0, opt_mVadc1 = 0, opt_mVadc2 = 0, opt_mVadc3 = 0;
+        int opt_oversample[ADC_CHANNELS] = {0};
+        char *opt_stream = NULL;
+        unsigned opt_stream_ch = 0x0f, opt_stream_rate = 1000, opt_stream_time = 0;
+        int opt_count[COUNTER_MAX_PINS], opt_ncount = 0, opt_window = 1000;
+        struct pwm_opt opt_pwm[PWM_MAX_CHANNELS];
+        int opt_npwm = 0, opt_pwm_time = 1000;
+        int opt_capture_pin[CAPTURE_MAX_PINS], opt_ncapture = 0;
+        int opt_capture_time = 10, opt_format = CAPTURE_VCD;
+        unsigned opt_capture_max = 1 << 20;
+        char *opt_capture = NULL, *opt_decode = NULL;
+        struct cbar_route opt_routes[64];
+        int opt_nroutes = 0, opt_cbar_get = 0;
+        char *opt_cbar_file = NULL;
+        char *opt_load_config = NULL, *opt_save_config = NULL;
         //char *opt_mac = NULL;
         int model;
         //uint8_t pokeval = 0;
@@ -468,6 +370,9 @@ int main(int argc, char **argv)
                 { "getmac", 0, 0, 'm' },
                 { "ddrout", 1, 0, 'o' },
                 { "ddrin", 1, 0, 'e' },
+                { "keep-exported", 0, 0, 'k' },
+                { "manifest", 1, 0, 'f' },
+                { "backend", 1, 0, 'B' },
                 { "sethigh", 1, 0, 'j' },
                 { "setlow", 1, 0, 'l' },
                 { "dac0", 1, 0, 'a' },
@@ -483,10 +388,36 @@ int main(int argc, char **argv)
                 { "getadcV1", 0, 0, 'x' },
                 { "getadcV2", 0, 0, 'y' },
                 { "getadcV3", 0, 0, 'z' },
+                { "oversample", 1, 0, 'O' },
+                { "stream", 1, 0, 'M' },
+                { "stream-ch", 1, 0, 'X' },
+                { "stream-rate", 1, 0, 'Q' },
+                { "stream-time", 1, 0, 'Y' },
+                { "count", 1, 0, 'C' },
+                { "window", 1, 0, 'W' },
+                { "pwm", 1, 0, 'U' },
+                { "pwm-time", 1, 0, 'V' },
+                { "capture", 1, 0, 'L' },
+                { "capture-pin", 1, 0, 'P' },
+                { "capture-time", 1, 0, 'T' },
+                { "capture-max", 1, 0, 'N' },
+                { "cbar-get", 0, 0, 'G' },
+                { "cbar-set", 1, 0, 'S' },
+                { "cbar-apply", 1, 0, 'A' },
+                { "load-config", 1, 0, 'R' },
+                { "save-config", 1, 0, 'E' },
+                { "decode", 1, 0, 'D' },
+                { "format", 1, 0, 'F' },
                 { 0, 0, 0, 0 }
         };
+        
+        if(getenv("TS7680CTL_KEEP_EXPORTED"))
+                gpio_set_export_policy(GPIO_EXPORT_KEEP);
+        if(getenv("TS7680CTL_GPIO_BACKEND") &&
+          gpio_set_backend(getenv("TS7680CTL_GPIO_BACKEND")))
+                return 1;
                 
-        while((c = getopt_long(argc, argv, "+o:hitme:j:l:a:b:c:d:pqrswxyzg:", 
+        while((c = getopt_long(argc, argv, "+o:hitme:kf:B:j:l:a:b:c:d:pqrswxyzg:O:M:X:Q:Y:C:W:U:V:L:P:T:N:GS:A:R:E:D:F:", 
           long_options, NULL)) != -1) {
                 int gpio;
                 
@@ -504,29 +435,40 @@ int main(int argc, char **argv)
                                 break;
                         case 'o':
                                 gpio = atoi(optarg);
-                                gpio_export(gpio);
+                                gpio_claim(gpio);
                                 pinMode(gpio, 1);
-                                gpio_unexport(gpio);
+                                gpio_release(gpio);
                                 break;
                         case 'e':
                                 gpio = atoi(optarg);
-                                gpio_export(gpio);
+                                gpio_claim(gpio);
                                 pinMode(gpio, 0);
-                                gpio_unexport(gpio);
+                                gpio_release(gpio);
+                                break;
+                        case 'k':
+                                gpio_set_export_policy(GPIO_EXPORT_KEEP);
+                                break;
+                        case 'B':
+                                if(gpio_set_backend(optarg))
+                                        return 1;
+                                break;
+                        case 'f':
+                                if(gpio_load_manifest(optarg) < 0)
+                                        return 1;
                                 break;
                      
                      // Digital and Analog Outputs
                         case 'j':
                                 gpio = atoi(optarg);
-                                gpio_export(gpio);
+                                gpio_claim(gpio);
                                 digitalWrite(gpio, 1);
-                                gpio_unexport(gpio);
+                                gpio_release(gpio);
                                 break;
                         case 'l':
                                 gpio = atoi(optarg);
-                                gpio_export(gpio);
+                                gpio_claim(gpio);
                                 digitalWrite(gpio, 0);
-                                gpio_unexport(gpio);
+                                gpio_release(gpio);
                                 break;
 			case 'a':
                                 opt_dac0 = ((strtoul(optarg, NULL, 0) & 0xfff)<<1)|0x1;
@@ -544,9 +486,9 @@ int main(int argc, char **argv)
                      // Digital and Analog Inputs
                         case 'g':
                                 gpio = atoi(optarg);
-                                gpio_export(gpio);
+                                gpio_claim(gpio);
                                 printf("gpio%d=%d\n", gpio, digitalRead(gpio));
-                                gpio_unexport(gpio);
+                                gpio_release(gpio);
                                 break;
                         case 'p':
                                 opt_mAadc0 = 1;
@@ -572,14 +514,114 @@ int main(int argc, char **argv)
                         case 'z':
                                 opt_mVadc3 = 1;
                                 break;
+                        case 'O':
+                                if(parse_oversample(optarg, opt_oversample))
+                                        return 1;
+                                break;
+                        case 'M':
+                                opt_stream = optarg;
+                                break;
+                        case 'X':
+                                if(parse_channels(optarg, &opt_stream_ch))
+                                        return 1;
+                                break;
+                        case 'Q':
+                                if(parse_rate(optarg, &opt_stream_rate))
+                                        return 1;
+                                break;
+                        case 'Y':
+                                opt_stream_time = strtoul(optarg, NULL, 0);
+                                break;
+                        case 'C':
+                                if(opt_ncount == COUNTER_MAX_PINS) {
+                                        fprintf(stderr, "Too many --count pins\n");
+                                        return 1;
+                                }
+                                opt_count[opt_ncount++] = atoi(optarg);
+                                break;
+                        case 'W':
+                                opt_window = atoi(optarg);
+                                if(opt_window <= 0)
+                                        opt_window = 1000;
+                                break;
+                        case 'U':
+                                if(opt_npwm == PWM_MAX_CHANNELS) {
+                                        fprintf(stderr, "Too many --pwm channels\n");
+                                        return 1;
+                                }
+                                if(parse_pwm(optarg, &opt_pwm[opt_npwm++]))
+                                        return 1;
+                                break;
+                        case 'V':
+                                opt_pwm_time = atoi(optarg);
+                                if(opt_pwm_time <= 0)
+                                        opt_pwm_time = 1000;
+                                break;
+                        case 'L':
+                                opt_capture = optarg;
+                                break;
+                        case 'P':
+                                if(opt_ncapture == CAPTURE_MAX_PINS) {
+                                        fprintf(stderr, "Too many --capture-pin pins\n");
+                                        return 1;
+                                }
+                                opt_capture_pin[opt_ncapture++] = atoi(optarg);
+                                break;
+                        case 'T':
+                                opt_capture_time = atoi(optarg);
+                                if(opt_capture_time <= 0)
+                                        opt_capture_time = 10;
+                                break;
+                        case 'N':
+                                opt_capture_max = strtoul(optarg, NULL, 0);
+                                if(!opt_capture_max)
+                                        opt_capture_max = 1 << 20;
+                                break;
+                        case 'G':
+                                opt_cbar_get = 1;
+                                break;
+                        case 'S':
+                                if(opt_nroutes == 64) {
+                                        fprintf(stderr, "Too many --cbar-set routes\n");
+                                        return 1;
+                                }
+                                if(cbar_parse(optarg, &opt_routes[opt_nroutes++]))
+                                        return 1;
+                                break;
+                        case 'A':
+                                opt_cbar_file = optarg;
+                                break;
+                        case 'R':
+                                opt_load_config = optarg;
+                                break;
+                        case 'E':
+                                opt_save_config = optarg;
+                                break;
+                        case 'D':
+                                opt_decode = optarg;
+                                break;
+                        case 'F':
+                                if(!strcmp(optarg, "csv"))
+                                        opt_format = CAPTURE_CSV;
+                                else if(!strcmp(optarg, "vcd"))
+                                        opt_format = CAPTURE_VCD;
+                                else {
+                                        fprintf(stderr, "Unknown format %s\n", optarg);
+                                        return 1;
+                                }
+                                break;
                         default:
                                 usage(argv);
                                 return 1;
                 }
         }
         
-        twifd = fpga_init(NULL, 0);
-        if(twifd == -1) {
+        // Decoding a capture needs no hardware
+        if(opt_decode)
+                return capture_decode(opt_decode, stdout, opt_format) ? 1 : 0;
+        
+        fpga = fpga_open(NULL, 0);
+        if(!fpga) {
                 perror("Can't open FPGA I2C bus");
                 return 1;
         }
@@ -587,733 +629,216 @@ int main(int argc, char **argv)
         if(opt_info) {
                 model = get_model();
                 printf("model=0x%X\n", model);
-                gpio_export(44);
+                gpio_claim(44);
                 printf("bootmode=0x%X\n", digitalRead(44) ? 1:0);
-                printf("fpga_revision=0x%X\n", fpeek8(twifd, 0x7F));
-                gpio_unexport(44);
+                printf("fpga_revision=0x%X\n", fpga_peek8(fpga, 0x7F));
+                gpio_release(44);
         }
         
-        if(opt_cputemp) {
-                signed int temp[2] = {0, 0}, x;
-                volatile unsigned int *mxlradcregs;
-                int devmem;
-                
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-                
-                mxlradcregs[0x148/4] = 0xff;
-                mxlradcregs[0x144/4] = 0x98; //Set to temp sense mode
-                mxlradcregs[0x28/4] = 0x8300; //Enable temp sense block
-                mxlradcregs[0x50/4] = 0x0; //Clear ch0 reg
-                mxlradcregs[0x60/4] = 0x0; //Clear ch1 reg
-                temp[0] = temp[2] = 0;
+        // The saved image goes first so anything else given overrides it
+        if(opt_load_config && fpga_config_load(fpga, opt_load_config) < 0)
+                return 1;
+        
+        if(opt_cbar_file || opt_nroutes) {
+                struct cbar_route routes[128];
+                int n = 0;
                 
-                for(x = 0; x < 10; x++) {
-                        /* Clear interrupts
-                         * Schedule readings
-                         * Poll for samples completion
-                         * Pull out samples */
-                        mxlradcregs[0x18/4] = 0x3;
-                        mxlradcregs[0x4/4] = 0x3;
-                        while(!((mxlradcregs[0x10/4] & 0x3) == 0x3));
-                        temp[0] += mxlradcregs[0x60/4] & 0xFFFF;
-                        temp[1] += mxlradcregs[0x50/4] & 0xFFFF;
+                if(opt_cbar_file) {
+                        n = cbar_load_file(opt_cbar_file, routes, 64);
+                        if(n < 0)
+                                return 1;
                 }
-                temp[0] = (((temp[0] - temp[1]) * (1012/4)) - 2730000);
-                printf("internal_temp=%d.%d\n", temp[0] / 10000,
-                  abs(temp[0] % 10000));
+                // --cbar-set comes last so it overrides the file
+                memcpy(routes + n, opt_routes, opt_nroutes * sizeof(routes[0]));
+                if(cbar_apply(fpga, routes, n + opt_nroutes) < 0)
+                        return 1;
+        }
+        
+        if(opt_cbar_get)
+                cbar_print(fpga, stdout);
+        
+        if(opt_cputemp) {
+                int temp;
                 
-                munmap((void *)mxlradcregs, getpagesize());
-                close(devmem);
+                if(adc_cputemp(get_adc(), &temp)) {
+                        perror("cputemp");
+                        return 1;
+                }
+                printf("internal_temp=%d.%d\n", temp / 10000, abs(temp % 10000));
         }
         
         if(opt_getmac) {
                 unsigned char a, b, c;
                 unsigned int mac;
-                int devmem;
-                volatile unsigned int *mxocotpregs;
                 
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-                mxocotpregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x8002C000);
-                
-                mxocotpregs[0x08/4] = 0x200;
-                mxocotpregs[0x0/4] = 0x1000;
-                while(mxocotpregs[0x0/4] & 0x100); //check busy flag
-                mac = mxocotpregs[0x20/4] & 0xFFFFFF;
-                if(!mac) {
-                        mxocotpregs[0x0/4] = 0x0; //close the reg first
-                        mxocotpregs[0x08/4] = 0x200;
-                        mxocotpregs[0x0/4] = 0x1013;
-                        while(mxocotpregs[0x0/4] & 0x100); //check busy flag
-                        mac = (unsigned short) mxocotpregs[0x150/4];
-                        mac |= 0x4f0000;
+                if(read_mac(&mac)) {
+                        perror("OCOTP");
+                        return 1;
                 }
-                mxocotpregs[0x0/4] = 0x0;
-                
                 a = mac >> 16;
                 b = mac >> 8;
                 c = mac;
                 
                 printf("mac=00:d0:69:%02x:%02x:%02x\n", a, b, c);
                 printf("shortmac=%02x:%02x:%02x\n", a, b, c);
-                
-                munmap((void *)mxocotpregs, getpagesize());
-                close(devmem);
-        }
-        
-        if(opt_dac0) {
-                char buf[2];
-                buf[0] = ((opt_dac0 >> 9) & 0xf);
-                buf[1] = ((opt_dac0 >> 1) & 0xff);
-                fpoke8(twifd, 0x2E, buf[0]);
-                fpoke8(twifd, 0x2F, buf[1]);
-        }
-        
-        if(opt_dac1) {
-                char buf[2];
-                buf[0] = ((opt_dac1 >> 9) & 0xf);
-                buf[1] = ((opt_dac1 >> 1) & 0xff);
-                fpoke8(twifd, 0x30, buf[0]);
-                fpoke8(twifd, 0x31, buf[1]);
-        }
-        
-        if(opt_dac2) {
-                char buf[2];
-                buf[0] = ((opt_dac2 >> 9) & 0xf);
-                buf[1] = ((opt_dac2 >> 1) & 0xff);
-                fpoke8(twifd, 0x32, buf[0]);
-                fpoke8(twifd, 0x33, buf[1]);
-        }
-        
-        if(opt_dac3) {
-                char buf[2];
-                buf[0] = ((opt_dac3 >> 9) & 0xf);
-                buf[1] = ((opt_dac3 >> 1) & 0xff);
-                fpoke8(twifd, 0x34, buf[0]);
-                fpoke8(twifd, 0x35, buf[1]);
         }
         
-        if(opt_mAadc0) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x, meas_mV;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
+        if(opt_ncount) {
+                struct pulse_counter *pc;
+                struct counter_reading r;
+                int i;
                 
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
-                }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
+                pc = counter_new(opt_window);
+                if(!pc)
+                        return 1;
+                // The counter requests or exports the pins itself
+                for(i = 0; i < opt_ncount; i++) {
+                        if(counter_add(pc, opt_count[i], 1, 0))
+                                return 1;
                 }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+                if(counter_start(pc)) {
+                        counter_free(pc);
+                        return 1;
                 }
-        
-                meas_mV = ((((chan[0]/10)*45177)*6235)/100000000);
-                printf("ADC0_val=%dmA\n", (unsigned int)(((meas_mV)*1000)/240));
+                usleep(opt_window * 1000);
+                counter_stop(pc);
                 
+                for(i = 0; i < opt_ncount; i++) {
+                        counter_read(pc, opt_count[i], &r);
+                        printf("gpio%d_count=%llu\n", opt_count[i],
+                          (unsigned long long)r.count);
+                        printf("gpio%d_freq=%.3fHz\n", opt_count[i],
+                          r.count * 1000.0 / opt_window);
+                        printf("gpio%d_period=%lluus\n", opt_count[i],
+                          (unsigned long long)(r.period_ns / 1000));
+                        printf("gpio%d_lost=%llu\n", opt_count[i],
+                          (unsigned long long)(r.count - r.events));
+                }
+                counter_free(pc);
         }
         
-        if(opt_mAadc1) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x, meas_mV;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
+        if(opt_npwm) {
+                struct pwm *pwm;
+                struct pwm_stats st;
+                int i;
                 
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
-                }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
+                pwm = pwm_new();
+                if(!pwm)
+                        return 1;
+                // pwm_set() exports the pins and makes them outputs
+                for(i = 0; i < opt_npwm; i++) {
+                        if(pwm_set(pwm, opt_pwm[i].gpio, opt_pwm[i].period_us,
+                          opt_pwm[i].duty_us)) {
+                                pwm_free(pwm);
+                                return 1;
+                        }
                 }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+                if(pwm_start(pwm)) {
+                        pwm_free(pwm);
+                        return 1;
                 }
-        
-                meas_mV = ((((chan[1]/10)*45177)*6235)/100000000);
-                printf("ADC1_val=%dmA\n", (unsigned int)(((meas_mV)*1000)/240));
+                usleep(opt_pwm_time * 1000);
+                pwm_get_stats(pwm, &st);
+                pwm_free(pwm);
                 
+                for(i = 0; i < st.nchannels; i++) {
+                        printf("gpio%d_pwm_cycles=%lu\n", st.ch[i].gpio,
+                          st.ch[i].cycles);
+                        printf("gpio%d_pwm_freq=%.3fHz\n", st.ch[i].gpio,
+                          st.ch[i].freq_hz);
+                }
+                printf("pwm_edges=%lu\n", st.edges);
+                printf("pwm_writes=%lu\n", st.writes);
+                printf("pwm_late_min=%lldus\n", (long long)st.late_min_ns / 1000);
+                printf("pwm_late_avg=%lldus\n", (long long)st.late_avg_ns / 1000);
+                printf("pwm_late_max=%lldus\n", (long long)st.late_max_ns / 1000);
         }
         
-        if(opt_mAadc2) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x, meas_mV;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
+        if(opt_capture) {
+                struct capture *cap;
                 
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
-                }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
-                }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+                if(!opt_ncapture) {
+                        fprintf(stderr, "--capture needs at least one --capture-pin\n");
+                        return 1;
                 }
-        
-                meas_mV = ((((chan[2]/10)*45177)*6235)/100000000);
-                printf("ADC2_val=%dmA\n", (unsigned int)(((meas_mV)*1000)/240));
-                
+                // The capture requests or exports the pins itself
+                cap = capture_open(opt_capture, opt_capture_pin, opt_ncapture,
+                  opt_capture_max);
+                if(!cap)
+                        return 1;
+                if(capture_run(cap, opt_capture_time * 1000))
+                        perror("capture");
+                if(capture_close(cap))
+                        perror(opt_capture);
         }
         
-        if(opt_mAadc3) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x, meas_mV;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
+        if(opt_dac0 || opt_dac1 || opt_dac2 || opt_dac3) {
+                int opts[FPGA_DAC_CHANNELS] = { opt_dac0, opt_dac1, opt_dac2, opt_dac3 };
+                uint16_t values[FPGA_DAC_CHANNELS];
+                unsigned mask = 0;
+                int i;
                 
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
-                }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
+                // Channels given together change together
+                for(i = 0; i < FPGA_DAC_CHANNELS; i++) {
+                        values[i] = (opts[i] >> 1) & 0xfff;
+                        if(opts[i])
+                                mask |= 1U << i;
                 }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
-                }
-        
-                meas_mV = ((((chan[3]/10)*45177)*6235)/100000000);
-                printf("ADC3_val=%dmA\n", (unsigned int)(((meas_mV)*1000)/240));
-                
+                dac_update(fpga, mask, values);
         }
         
-        if(opt_mVadc0) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
+        if(opt_mAadc0 || opt_mAadc1 || opt_mAadc2 || opt_mAadc3 ||
+          opt_mVadc0 || opt_mVadc1 || opt_mVadc2 || opt_mVadc3) {
+                int ma[4] = { opt_mAadc0, opt_mAadc1, opt_mAadc2, opt_mAadc3 };
+                int mv[4] = { opt_mVadc0, opt_mVadc1, opt_mVadc2, opt_mVadc3 };
+                int codes[ADC_CHANNELS];
+                unsigned mask = 0;
+                int i;
                 
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
+                for(i = 0; i < ADC_CHANNELS; i++) {
+                        if(opt_oversample[i])
+                                adc_set_oversample(get_adc(), i, opt_oversample[i]);
                 }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
+                // One conversion pass serves every channel asked for
+                for(i = 0; i < 4; i++) {
+                        if(ma[i] || mv[i])
+                                mask |= 1U << i;
                 }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
-                }
-        
-                printf("ADC0_val=%dmV\n", (unsigned int)((((chan[0]/10)*45177)*6235)/100000000));
-        }
-        
-        if(opt_mVadc1) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
+                if(adc_read_mask(get_adc(), mask, codes)) {
+                        perror("ADC");
+                        return 1;
                 }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
+                for(i = 0; i < 4; i++) {
+                        if(ma[i])
+                                printf("ADC%d_val=%dmA\n", i, adc_code_to_ma(codes[i]));
                 }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+                for(i = 0; i < 4; i++) {
+                        if(mv[i])
+                                printf("ADC%d_val=%dmV\n", i, adc_code_to_mv(codes[i]));
                 }
-        
-                printf("ADC1_val=%dmV\n", (unsigned int)((((chan[1]/10)*45177)*6235)/100000000));
         }
         
-        if(opt_mVadc2) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
+        if(opt_stream) {
+                int i;
                 
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
-                }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
-                }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
-                }
-        
-                printf("ADC2_val=%dmV\n", (unsigned int)((((chan[2]/10)*45177)*6235)/100000000));
+                // Hardware oversampling paces samples at 2 kHz, too slow
+                // for a stream unless asked for
+                adc_set_oversample(get_adc(), -1, 1);
+                for(i = 0; i < ADC_CHANNELS; i++) {
+                        if(opt_oversample[i])
+                                adc_set_oversample(get_adc(), i, opt_oversample[i]);
+                }
+                if(stream(opt_stream, opt_stream_ch, opt_stream_rate, opt_stream_time,
+                  opt_format == CAPTURE_CSV ? ADC_STREAM_CSV : ADC_STREAM_BINARY))
+                        return 1;
         }
         
-        if(opt_mVadc3) {
-                volatile unsigned int *mxlradcregs;
-                volatile unsigned int *mxhsadcregs;
-                volatile unsigned int *mxclkctrlregs;
-                unsigned int i, x;
-                unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-                int devmem;
-        
-                devmem = open("/dev/mem", O_RDWR|O_SYNC);
-                assert(devmem != -1);
-        
-                // LRADC
-                mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
-        
-                mxlradcregs[0x148/4] = 0xfffffff; //Clears LRADC6:0 assignments
-                mxlradcregs[0x144/4] = 0x6543210; //set LRADC6:0 to channel 6:0
-                mxlradcregs[0x28/4] = 0xff000000; //set 1.8V Range
-                for(x = 0; x < 7; x++)
-                  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
-        
-                for(x = 0; x < 10; x++) {
-                        mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-                        mxlradcregs[0x4/4] = 0x7f; //Schedule conversion of chan 6:0
-                        while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //wait
-                        for(i = 0; i < 7; i++)
-                          chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
-                }
-        
-                mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80002000);
-                mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-                  devmem, 0x80040000);
-        
-                //HSADC
-                //See if the HSADC needs to be brought out of reset
-                if(mxhsadcregs[0x0/4] & 0xc0000000) {
-                        mxclkctrlregs[0x154/4] = 0x70000000;
-                        mxclkctrlregs[0x1c8/4] = 0x8000;
-                        //ENGR116296 errata workaround
-                        mxhsadcregs[0x8/4] = 0x80000000;
-                        mxhsadcregs[0x0/4] = ((mxhsadcregs[0x0/4] | 0x80000000) & (~0x40000000));
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                        mxhsadcregs[0x8/4] = 0x40000000;
-                        mxhsadcregs[0x4/4] = 0x40000000;
-                
-                        usleep(10);
-                        mxhsadcregs[0x8/4] = 0xc0000000;
-                }
-        
-                mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
-                mxhsadcregs[0x24/4] = 0x31; //Set precharge and SH bypass
-                mxhsadcregs[0x30/4] = 0xa; //Set sample num
-                mxhsadcregs[0x40/4] = 0x1; //Set seq num
-                mxhsadcregs[0x4/4] = 0x40000; //12bit mode
-        
-                while(!(mxhsadcregs[0x10/4] & 0x20)) {
-                        mxhsadcregs[0x50/4]; //Empty FIFO
-                }
-        
-                mxhsadcregs[0x50/4]; //An extra read is necessary
-        
-                mxhsadcregs[0x14/4] = 0xfc000000; //Clear interrupts
-                mxhsadcregs[0x4/4] = 0x1; //Set HS_RUN
-                usleep(10);
-                mxhsadcregs[0x4/4] = 0x08000000; //Start conversion
-                while(!(mxhsadcregs[0x10/4] & 0x1)); //Wait for interrupt
-        
-                for(i = 0; i < 5; i++) {
-                        x = mxhsadcregs[0x50/4];
-                        chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
-                }
-        
-                printf("ADC3_val=%dmV\n", (unsigned int)((((chan[3]/10)*45177)*6235)/100000000));
-        }
+        // Last, so the image includes whatever this run changed
+        if(opt_save_config && fpga_config_save(fpga, opt_save_config))
+                return 1;
         
-        close(twifd);
+        adc_close(adc);
+        fpga_close(fpga);
         
         return 0;
 }